@@ -0,0 +1,268 @@
+#include "BinaryProtocol.h"
+
+#include <cmath>
+
+#include "PerfectHash.h"
+#include "utils.h"
+
+namespace {
+    void putInt16(std::string& out, const int16_t value) {
+        const auto raw = static_cast<uint16_t>(value);
+        out += static_cast<char>(raw & 0xFF);
+        out += static_cast<char>(raw >> 8);
+    }
+
+    void putInt32(std::string& out, const int32_t value) {
+        const auto raw = static_cast<uint32_t>(value);
+        for (int shift = 0; shift < 32; shift += 8) {
+            out += static_cast<char>((raw >> shift) & 0xFF);
+        }
+    }
+
+    uint16_t getUint16(const std::string_view data, const size_t offset) {
+        return static_cast<uint8_t>(data[offset]) | static_cast<uint16_t>(static_cast<uint8_t>(data[offset + 1]) << 8);
+    }
+
+    int32_t getInt32(const std::string_view data, const size_t offset) {
+        uint32_t raw = 0;
+        for (int i = 0; i < 4; i++) {
+            raw |= static_cast<uint32_t>(static_cast<uint8_t>(data[offset + i])) << (8 * i);
+        }
+        return static_cast<int32_t>(raw);
+    }
+
+    bool fitsInt16(const float value) {
+        return value >= INT16_MIN && value <= INT16_MAX;
+    }
+
+    bool encodeInt16Args(const std::string_view args, const size_t count, std::string& out) {
+        std::array<std::string_view, 3> fields;
+        if (TCPUtils::splitView(args, ',', fields) != count) {
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            float value;
+            if (!TCPUtils::parseNumber(fields[i], value) || !fitsInt16(value)) {
+                return false;
+            }
+            // Truncated like the text encoder, both kinds of clients see the same pose
+            putInt16(out, static_cast<int16_t>(value));
+        }
+        return true;
+    }
+
+    bool encodeAruco(std::string_view args, std::string& out) {
+        const size_t countOffset = out.size();
+        out += '\0';
+        if (args == "404") {
+            return true;
+        }
+
+        uint8_t count = 0;
+        std::array<std::string_view, 7> fields;
+        while (true) {
+            size_t nbFields = 0;
+            while (nbFields < fields.size() && TCPUtils::nextToken(args, ',', fields[nbFields])) {
+                nbFields++;
+            }
+            if (nbFields == 0) break;
+            if (nbFields < fields.size() || count == UINT8_MAX || fields[1].size() > UINT8_MAX) return false;
+
+            int id;
+            std::array<float, 5> values{};
+            if (!TCPUtils::parseNumber(fields[0], id) || !fitsInt16(static_cast<float>(id))) return false;
+            for (int i = 0; i < 5; i++) {
+                if (!TCPUtils::parseNumber(fields[i + 2], values[i])) return false;
+            }
+
+            putInt16(out, static_cast<int16_t>(id));
+            out += static_cast<char>(fields[1].size());
+            out.append(fields[1]);
+            putInt32(out, static_cast<int32_t>(std::lround(values[0] * 100)));
+            putInt32(out, static_cast<int32_t>(std::lround(values[1] * 100)));
+            for (int i = 2; i < 5; i++) {
+                putInt32(out, static_cast<int32_t>(std::lround(values[i] * 1000)));
+            }
+            count++;
+        }
+
+        out[countOffset] = static_cast<char>(count);
+        return true;
+    }
+
+    bool arucoToText(const std::string_view payload, std::pmr::string& out) {
+        if (payload.empty()) return false;
+
+        const auto count = static_cast<uint8_t>(payload[0]);
+        if (count == 0) {
+            out += "404";
+            return true;
+        }
+
+        size_t offset = 1;
+        for (int tag = 0; tag < count; tag++) {
+            if (offset + 3 > payload.size()) return false;
+            const auto id = static_cast<int16_t>(getUint16(payload, offset));
+            const auto nameSize = static_cast<uint8_t>(payload[offset + 2]);
+            offset += 3;
+            if (offset + nameSize + 20 > payload.size()) return false;
+
+            if (tag > 0) out += ',';
+            out += std::to_string(id);
+            out += ',';
+            out.append(payload.substr(offset, nameSize));
+            offset += nameSize;
+
+            for (int i = 0; i < 5; i++) {
+                const float scale = i < 2 ? 100.f : 1000.f;
+                out += ',';
+                out += std::to_string(static_cast<float>(getInt32(payload, offset)) / scale);
+                offset += 4;
+            }
+        }
+        return true;
+    }
+}
+
+uint8_t BinaryProtocol::participantId(const std::string_view name) {
+    static constexpr PerfectHash<PARTICIPANTS.size()> participants(PARTICIPANTS);
+    int id = participants.find(name);
+    return id == -1 ? static_cast<uint8_t>(PARTICIPANT_UNKNOWN) : static_cast<uint8_t>(id);
+}
+
+std::string_view BinaryProtocol::participantName(const uint8_t id) {
+    return id < PARTICIPANTS.size() ? PARTICIPANTS[id] : std::string_view();
+}
+
+BinaryType BinaryProtocol::typeOfVerb(const std::string_view verb) {
+    if (verb == "set pos") return BINARY_POSE;
+    if (verb == "set speed") return BINARY_SPEED;
+    if (verb == "set state") return BINARY_STATE;
+    if (verb == "get aruco") return BINARY_ARUCO;
+    return BINARY_NONE;
+}
+
+std::string_view BinaryProtocol::verbOfType(const BinaryType type) {
+    switch (type) {
+        case BINARY_POSE:
+            return "set pos";
+        case BINARY_SPEED:
+            return "set speed";
+        case BINARY_STATE:
+            return "set state";
+        case BINARY_ARUCO:
+            return "get aruco";
+        default:
+            return {};
+    }
+}
+
+size_t BinaryProtocol::frameSize(const std::string_view data) {
+    if (data.size() < BINARY_HEADER_SIZE) {
+        return 0;
+    }
+    return BINARY_HEADER_SIZE + getUint16(data, 4);
+}
+
+bool BinaryProtocol::encode(const std::string_view sender, const std::string_view receiver, const std::string_view verb, const std::string_view args, std::string& out) {
+    const BinaryType type = typeOfVerb(verb);
+    const uint8_t senderId = participantId(sender);
+    const uint8_t receiverId = participantId(receiver);
+    if (type == BINARY_NONE || senderId == PARTICIPANT_UNKNOWN || receiverId == PARTICIPANT_UNKNOWN) {
+        return false;
+    }
+
+    out.clear();
+    out += BINARY_MAGIC;
+    out += static_cast<char>(type);
+    out += static_cast<char>(senderId);
+    out += static_cast<char>(receiverId);
+    putInt16(out, 0);
+
+    bool encoded;
+    switch (type) {
+        case BINARY_POSE:
+            encoded = encodeInt16Args(args, 3, out);
+            break;
+        case BINARY_SPEED:
+        case BINARY_STATE:
+            encoded = encodeInt16Args(args, 1, out);
+            break;
+        case BINARY_ARUCO:
+            encoded = encodeAruco(args, out);
+            break;
+        default:
+            encoded = false;
+            break;
+    }
+
+    const size_t payloadSize = out.size() - BINARY_HEADER_SIZE;
+    if (!encoded || payloadSize > UINT16_MAX) {
+        out.clear();
+        return false;
+    }
+
+    out[4] = static_cast<char>(payloadSize & 0xFF);
+    out[5] = static_cast<char>(payloadSize >> 8);
+    return true;
+}
+
+bool BinaryProtocol::decodeHeader(const std::string_view frame, Header& header) {
+    if (frame.size() < BINARY_HEADER_SIZE || frame[0] != BINARY_MAGIC || frameSize(frame) != frame.size()) {
+        return false;
+    }
+
+    header.type = static_cast<BinaryType>(frame[1]);
+    header.sender = static_cast<uint8_t>(frame[2]);
+    header.receiver = static_cast<uint8_t>(frame[3]);
+    header.payload = frame.substr(BINARY_HEADER_SIZE);
+
+    switch (header.type) {
+        case BINARY_POSE:
+            return header.payload.size() == 6;
+        case BINARY_SPEED:
+        case BINARY_STATE:
+            return header.payload.size() == 2;
+        case BINARY_ARUCO:
+            return !header.payload.empty();
+        default:
+            return false;
+    }
+}
+
+int16_t BinaryProtocol::readInt16(const std::string_view payload, const size_t index) {
+    return static_cast<int16_t>(getUint16(payload, index * 2));
+}
+
+bool BinaryProtocol::toText(const std::string_view frame, std::pmr::string& out) {
+    Header header{};
+    if (!decodeHeader(frame, header)) {
+        return false;
+    }
+
+    const std::string_view sender = participantName(header.sender);
+    const std::string_view receiver = participantName(header.receiver);
+    if (sender.empty() || receiver.empty()) {
+        return false;
+    }
+
+    out.clear();
+    out.append(sender).append(";").append(receiver).append(";").append(verbOfType(header.type)).append(";");
+
+    switch (header.type) {
+        case BINARY_POSE:
+            for (size_t i = 0; i < 3; i++) {
+                if (i > 0) out += ',';
+                out += std::to_string(readInt16(header.payload, i));
+            }
+            return true;
+        case BINARY_SPEED:
+        case BINARY_STATE:
+            out += std::to_string(readInt16(header.payload, 0));
+            return true;
+        case BINARY_ARUCO:
+            return arucoToText(header.payload, out);
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+/*
+ * Compact binary frames for telemetry, negotiated with "bin" in the arguments of ready.
+ *
+ * Header (little endian) : magic, type, sender id, receiver id, uint16 payload size
+ * POSE  : int16 x, int16 y, int16 theta * 100
+ * SPEED : int16 speed
+ * STATE : int16 state
+ * ARUCO : uint8 count, then per tag int16 id, uint8 name size, name, int32 x * 100, int32 y * 100, int32 rot * 1000 (x3)
+ *
+ * The magic byte can never start a text line, so both formats share one stream.
+ */
+#define BINARY_MAGIC static_cast<char>(0xB5)
+#define BINARY_HEADER_SIZE 6
+
+enum BinaryType : uint8_t {
+    BINARY_NONE = 0,
+    BINARY_POSE = 1,
+    BINARY_SPEED = 2,
+    BINARY_STATE = 3,
+    BINARY_ARUCO = 4,
+};
+
+// Sender and receiver ids, in the order of PARTICIPANTS
+enum Participant : uint8_t {
+    PARTICIPANT_STRAT,
+    PARTICIPANT_ALL,
+    PARTICIPANT_TIRETTE,
+    PARTICIPANT_IHM,
+    PARTICIPANT_LIDAR,
+    PARTICIPANT_ARDUINO,
+    PARTICIPANT_SERVO_MOTEUR,
+    PARTICIPANT_ARUCO,
+    PARTICIPANT_UNKNOWN = 0xFF,
+};
+
+constexpr std::array<std::string_view, 8> PARTICIPANTS = {
+    "strat", "all", "tirette", "ihm", "lidar", "arduino", "servo_moteur", "aruco"
+};
+
+namespace BinaryProtocol {
+    uint8_t participantId(std::string_view name);
+
+    std::string_view participantName(uint8_t id);
+
+    BinaryType typeOfVerb(std::string_view verb);
+
+    std::string_view verbOfType(BinaryType type);
+
+    // Full size of the frame starting with this header, 0 if the header is not complete yet
+    size_t frameSize(std::string_view data);
+
+    // Encode a text message, return false if it has no binary form
+    bool encode(std::string_view sender, std::string_view receiver, std::string_view verb, std::string_view args, std::string& out);
+
+    // Rebuild the text message "sender;receiver;verb;args" of a binary frame
+    bool toText(std::string_view frame, std::pmr::string& out);
+
+    struct Header {
+        BinaryType type;
+        uint8_t sender;
+        uint8_t receiver;
+        std::string_view payload;
+    };
+
+    bool decodeHeader(std::string_view frame, Header& header);
+
+    // Read the n-th int16 field of a POSE, SPEED or STATE payload
+    int16_t readInt16(std::string_view payload, size_t index);
+}
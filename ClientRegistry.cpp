@@ -0,0 +1,135 @@
+#include "ClientRegistry.h"
+
+#include <algorithm>
+
+#include "BinaryProtocol.h"
+
+namespace {
+    const std::vector<int> noRoute;
+}
+
+const ClientEntry* RegistrySnapshot::find(const int socket) const {
+    if (socket < 0 || static_cast<size_t>(socket) >= bySocket.size() || bySocket[socket].socket == -1) {
+        return nullptr;
+    }
+    return &bySocket[socket];
+}
+
+int RegistrySnapshot::nameId(const std::string_view name) const {
+    // The participants are interned first, their id is their Participant value
+    uint8_t participant = BinaryProtocol::participantId(name);
+    if (participant != PARTICIPANT_UNKNOWN) {
+        return participant;
+    }
+    auto it = nameIds.find(name);
+    return it == nameIds.end() ? -1 : it->second;
+}
+
+const std::vector<int>& RegistrySnapshot::route(const int nameId) const {
+    if (nameId < 0 || static_cast<size_t>(nameId) >= routes.size()) {
+        return noRoute;
+    }
+    return routes[nameId];
+}
+
+const std::vector<int>& RegistrySnapshot::route(const std::string_view name) const {
+    return route(nameId(name));
+}
+
+ClientEntry& RegistrySnapshot::add(const int socket) {
+    if (static_cast<size_t>(socket) >= bySocket.size()) {
+        bySocket.resize(socket + 1);
+    }
+    if (bySocket[socket].socket == -1) {
+        sockets.push_back(socket);
+    }
+    bySocket[socket] = ClientEntry();
+    bySocket[socket].socket = socket;
+    return bySocket[socket];
+}
+
+void RegistrySnapshot::remove(const int socket) {
+    const ClientEntry* client = find(socket);
+    if (!client) {
+        return;
+    }
+
+    unroute(socket);
+    sockets.erase(std::remove(sockets.begin(), sockets.end(), socket), sockets.end());
+    bool subscribed = !client->topics.empty();
+    bySocket[socket] = ClientEntry();
+    if (subscribed) {
+        compileTopics();
+    }
+}
+
+int RegistrySnapshot::intern(const std::string_view name) {
+    // nameId would answer for the participants before they are interned
+    if (auto it = nameIds.find(name); it != nameIds.end()) {
+        return it->second;
+    }
+    if (freeIds.empty() && names.size() >= MAX_CLIENT_NAMES) {
+        return -1;
+    }
+
+    int id;
+    if (!freeIds.empty()) {
+        id = freeIds.back();
+        freeIds.pop_back();
+        names[id] = name;
+    } else {
+        id = static_cast<int>(names.size());
+        names.emplace_back(name);
+        routes.emplace_back();
+    }
+    nameIds.emplace(name, id);
+    return id;
+}
+
+void RegistrySnapshot::unroute(const int socket) {
+    ClientEntry& client = bySocket[socket];
+    if (client.nameId == -1) {
+        return;
+    }
+
+    auto& route = routes[client.nameId];
+    route.erase(std::remove(route.begin(), route.end(), socket), route.end());
+    // The ids of the participants are their Participant values, they are kept
+    if (route.empty() && static_cast<size_t>(client.nameId) >= PARTICIPANTS.size()) {
+        nameIds.erase(names[client.nameId]);
+        names[client.nameId].clear();
+        freeIds.push_back(client.nameId);
+    }
+    client.nameId = -1;
+}
+
+void RegistrySnapshot::compileTopics() {
+    auto matcher = std::make_shared<TopicMatcher>();
+    bool any = false;
+    for (int socket : sockets) {
+        for (const auto& pattern : bySocket[socket].topics) {
+            matcher->add(pattern, socket);
+            any = true;
+        }
+    }
+    topics = any ? std::move(matcher) : nullptr;
+}
+
+ClientRegistry::ClientRegistry() {
+    auto initial = std::make_shared<RegistrySnapshot>();
+    for (const auto& participant : PARTICIPANTS) {
+        initial->intern(participant);
+    }
+    current = std::move(initial);
+}
+
+SnapshotPtr ClientRegistry::snapshot() const {
+    return std::atomic_load(&current);
+}
+
+void ClientRegistry::update(const std::function<void(RegistrySnapshot&)>& change) {
+    std::lock_guard lock(writerMutex);
+    auto next = std::make_shared<RegistrySnapshot>(*std::atomic_load(&current));
+    change(*next);
+    std::atomic_store(&current, SnapshotPtr(std::move(next)));
+}
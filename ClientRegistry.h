@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "OutboundQueue.h"
+#include "TopicMatcher.h"
+
+#define MAX_CLIENT_NAMES 256
+
+struct Reactor;
+
+// A connected client as seen by the threads that send to it
+struct ClientEntry {
+    int socket = -1; // -1 for a free slot
+    std::shared_ptr<OutboundQueue> queue;
+    Reactor* reactor = nullptr; // The reactor that owns the socket and writes its queue
+    uint32_t generation = 0; // Generation of its handler in that reactor
+    int nameId = -1; // Name it sent ready with
+    int features = 0; // ClientFeature flags announced with ready
+    bool poseSubscriber = false; // Sent subscribe pos
+    uint32_t watchedKeys = 0; // StateKey bits it sent watch values for
+    std::vector<std::string> topics; // sender/verb patterns it subscribed to
+};
+
+/*
+ * Immutable view of every client, never modified once published.
+ *
+ * Client names are interned to small ids, the participants of the binary protocol first so that
+ * their id is their Participant value. The id of any other name is freed once no client is routed
+ * under it, so the table only ever holds the names of connected clients.
+ */
+struct RegistrySnapshot {
+    std::vector<ClientEntry> bySocket; // Socket -> client
+    std::vector<int> sockets; // Connected sockets, in connection order
+    std::vector<std::vector<int>> routes; // Name id -> sockets of the clients that registered under it with ready
+    std::vector<std::string> names; // Name id -> name, empty once freed
+    std::map<std::string, int, std::less<>> nameIds; // Only looked up for names that are not participants
+    std::vector<int> freeIds; // Ids of names no client uses any more
+    std::shared_ptr<const TopicMatcher> topics; // Compiled from the topics of every client, null if there are none
+
+    [[nodiscard]] const ClientEntry* find(int socket) const;
+
+    // -1 if no client uses this name, a participant is found by perfect hash without touching nameIds
+    [[nodiscard]] int nameId(std::string_view name) const;
+
+    // Clients registered under the name, empty if nobody sent ready with it
+    [[nodiscard]] const std::vector<int>& route(int nameId) const;
+
+    [[nodiscard]] const std::vector<int>& route(std::string_view name) const;
+
+    // Writers only
+
+    ClientEntry& add(int socket);
+
+    void remove(int socket);
+
+    // -1 once MAX_CLIENT_NAMES are taken
+    int intern(std::string_view name);
+
+    // Stop routing the name of the client to it, free the name if it was the last one using it
+    void unroute(int socket);
+
+    // Rebuild the matcher after the topics of a client changed
+    void compileTopics();
+};
+
+using SnapshotPtr = std::shared_ptr<const RegistrySnapshot>;
+
+/*
+ * Copy-on-write registry of the connected clients.
+ *
+ * Readers take the current snapshot and iterate it without holding any lock, a snapshot stays valid
+ * as long as they keep the pointer. Writers copy the current snapshot, change the copy and publish it,
+ * they are serialised between them but never wait for the readers.
+ */
+class ClientRegistry {
+public:
+    ClientRegistry();
+
+    [[nodiscard]] SnapshotPtr snapshot() const;
+
+    // Publish a modified copy of the current snapshot
+    void update(const std::function<void(RegistrySnapshot&)>& change);
+
+private:
+    SnapshotPtr current;
+    std::mutex writerMutex;
+};
@@ -0,0 +1,53 @@
+#include "Frame.h"
+
+#include <algorithm>
+
+#include "utils.h"
+#include "BinaryProtocol.h"
+
+FramePtr Frame::fromMessage(const std::string_view message) {
+    auto frame = std::make_shared<Frame>();
+    frame->text.reserve(message.size() + 1);
+    frame->text.append(message);
+    if (frame->text.empty() || frame->text.back() != '\n') {
+        frame->text += '\n';
+    }
+
+    std::array<std::string_view, 4> tokens;
+    size_t nbTokens = TCPUtils::splitView(message, ';', tokens);
+    bool telemetry = nbTokens >= 3 && (tokens[1] == "all" ||
+        std::find(TELEMETRY_SENDERS.begin(), TELEMETRY_SENDERS.end(), tokens[0]) != TELEMETRY_SENDERS.end());
+    if (telemetry) {
+        for (const auto& verb : LATEST_VALUE_VERBS) {
+            if (tokens[2] == verb) {
+                frame->topic.append(tokens[0]).append(";").append(tokens[2]);
+                if (verb == "set value" && nbTokens >= 4) {
+                    frame->topic.append(";").append(tokens[3].substr(0, tokens[3].find(',')));
+                }
+                break;
+            }
+        }
+    }
+    frame->encodable = true;
+
+    return frame;
+}
+
+const std::string& Frame::binary() const {
+    std::call_once(binaryOnce, [this]() {
+        if (!encodable) {
+            return;
+        }
+        std::array<std::string_view, 4> tokens;
+        if (TCPUtils::splitView(std::string_view(text).substr(0, text.size() - 1), ';', tokens) == 4) {
+            BinaryProtocol::encode(tokens[0], tokens[1], tokens[2], tokens[3], binaryBytes);
+        }
+    });
+    return binaryBytes;
+}
+
+FramePtr Frame::fromBytes(std::string bytes) {
+    auto frame = std::make_shared<Frame>();
+    frame->text = std::move(bytes);
+    return frame;
+}
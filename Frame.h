@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+struct Frame;
+
+// Frames are immutable once built, every destination queue holds a reference to the same one
+using FramePtr = std::shared_ptr<const Frame>;
+
+// Verbs that only carry the latest state, a newer frame makes the pending one useless
+// A set value only replaces a pending value of the same key
+constexpr std::array<std::string_view, 3> LATEST_VALUE_VERBS = {"set pos", "set speed", "set value"};
+
+// Devices whose latest value frames are telemetry, the same verbs sent to a single device are commands
+// and never coalesced, only telemetry and broadcasts to all are
+constexpr std::array<std::string_view, 2> TELEMETRY_SENDERS = {"arduino", "lidar"};
+
+struct Frame {
+    std::string text; // Wire bytes, ending with '\n' unless built from raw bytes
+    std::string topic; // "sender;verb" for telemetry latest value frames, empty otherwise
+
+    // Binary form for clients that negotiated it, empty if the message has none
+    // Encoded the first time a binary client needs it, a server with text clients only never does
+    [[nodiscard]] const std::string& binary() const;
+
+    // Serialize a message once, adding the trailing '\n' if it is missing
+    static FramePtr fromMessage(std::string_view message);
+
+    // Bytes already on the wire format, e.g. the unsent tail of a queue, sent as they are
+    static FramePtr fromBytes(std::string bytes);
+
+private:
+    bool encodable = false; // Built by fromMessage, raw bytes have no binary form
+    mutable std::once_flag binaryOnce;
+    mutable std::string binaryBytes;
+};
@@ -0,0 +1,293 @@
+#include "Handoff.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+size_t HandoffState::fdCount() const {
+    return listenSockets + (unixSocket ? 1 : 0) + clients.size();
+}
+
+// Each record is a header line followed by the raw bytes whose sizes it gives
+std::string HandoffState::serialize() const {
+    std::string data = "listen;" + std::to_string(listenSockets) + "\n";
+    data += "unix;" + std::to_string(unixSocket ? 1 : 0) + "\n";
+
+    for (const auto& [key, value] : values) {
+        data += "value;" + key + ";" + std::to_string(value.size()) + "\n";
+        data += value;
+    }
+
+    for (const auto& client : clients) {
+        // Patterns never contain a comma, it separates them on the wire too
+        std::string topics;
+        for (const auto& topic : client.topics) {
+            topics += topic + ",";
+        }
+
+        data += "client;" + std::to_string(client.features) + ";" + std::to_string(client.poseSubscriber ? 1 : 0) + ";" +
+                std::to_string(client.watchedKeys) + ";" + std::to_string(topics.size()) + ";" +
+                std::to_string(client.name.size()) + ";" + std::to_string(client.input.size()) + ";" +
+                std::to_string(client.output.size()) + "\n";
+        data += topics;
+        data += client.name;
+        data += client.input;
+        data += client.output;
+    }
+
+    return data;
+}
+
+bool HandoffState::parse(std::string_view data) {
+    // Take size raw bytes off the front of data
+    auto take = [&data](size_t size, std::string& out) {
+        if (size > data.size()) {
+            return false;
+        }
+        out.assign(data.substr(0, size));
+        data.remove_prefix(size);
+        return true;
+    };
+
+    while (!data.empty()) {
+        size_t end = data.find('\n');
+        if (end == std::string_view::npos) {
+            return false;
+        }
+        std::string_view line = data.substr(0, end);
+        data.remove_prefix(end + 1);
+
+        std::array<std::string_view, 8> tokens;
+        size_t nbTokens = TCPUtils::splitView(line, ';', tokens);
+
+        if (tokens[0] == "listen" && nbTokens == 2) {
+            if (!TCPUtils::parseNumber(tokens[1], listenSockets)) {
+                return false;
+            }
+        } else if (tokens[0] == "unix" && nbTokens == 2) {
+            unixSocket = tokens[1] == "1";
+        } else if (tokens[0] == "value" && nbTokens == 3) {
+            size_t size;
+            if (!TCPUtils::parseNumber(tokens[2], size) || !take(size, values[std::string(tokens[1])])) {
+                return false;
+            }
+        } else if (tokens[0] == "client" && nbTokens == 8) {
+            HandoffClient client;
+            size_t topicsSize, nameSize, inputSize, outputSize;
+            std::string topics;
+            if (!TCPUtils::parseNumber(tokens[1], client.features) || !TCPUtils::parseNumber(tokens[3], client.watchedKeys) ||
+                !TCPUtils::parseNumber(tokens[4], topicsSize) || !TCPUtils::parseNumber(tokens[5], nameSize) ||
+                !TCPUtils::parseNumber(tokens[6], inputSize) || !TCPUtils::parseNumber(tokens[7], outputSize) ||
+                !take(topicsSize, topics) || !take(nameSize, client.name) || !take(inputSize, client.input) || !take(outputSize, client.output)) {
+                return false;
+            }
+            client.poseSubscriber = tokens[2] == "1";
+            std::string_view remaining = topics;
+            std::string_view topic;
+            while (TCPUtils::nextToken(remaining, ',', topic)) {
+                client.topics.emplace_back(topic);
+            }
+            clients.push_back(std::move(client));
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+namespace {
+    bool fillAddress(const std::string& path, sockaddr_un& address) {
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Handoff socket path too long : " << path << std::endl;
+            return false;
+        }
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        return true;
+    }
+
+    void closeAll(std::vector<int>& fds) {
+        for (int fd : fds) {
+            close(fd);
+        }
+        fds.clear();
+    }
+}
+
+int HandoffChannel::listenOn(const std::string& path) {
+    sockaddr_un address{};
+    if (!fillAddress(path, address)) {
+        return -1;
+    }
+
+    int handoffSocket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (handoffSocket == -1) {
+        return -1;
+    }
+
+    // Left behind by the server we just replaced, or by one that did not stop cleanly
+    unlink(path.c_str());
+
+    if (bind(handoffSocket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1 || listen(handoffSocket, 1) == -1) {
+        close(handoffSocket);
+        return -1;
+    }
+    return handoffSocket;
+}
+
+int HandoffChannel::connectTo(const std::string& path) {
+    sockaddr_un address{};
+    if (!fillAddress(path, address)) {
+        return -1;
+    }
+
+    int channel = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (channel == -1) {
+        return -1;
+    }
+
+    if (connect(channel, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1) {
+        close(channel);
+        return -1;
+    }
+
+    setTimeouts(channel);
+    return channel;
+}
+
+void HandoffChannel::setTimeouts(int channel) {
+    timeval timeout{};
+    timeout.tv_sec = HANDOFF_TIMEOUT_MS / 1000;
+    timeout.tv_usec = HANDOFF_TIMEOUT_MS % 1000 * 1000;
+    setsockopt(channel, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(channel, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+bool HandoffChannel::send(int channel, const std::vector<int>& fds, std::string_view state) {
+    if (!sendMessage(channel, "handoff;" + std::to_string(HANDOFF_VERSION) + ";" + std::to_string(fds.size()) + ";" + std::to_string(state.size()))) {
+        return false;
+    }
+
+    for (size_t sent = 0; sent < fds.size(); sent += HANDOFF_MAX_FDS_PER_MESSAGE) {
+        size_t count = std::min<size_t>(HANDOFF_MAX_FDS_PER_MESSAGE, fds.size() - sent);
+
+        char marker = 'f';
+        iovec iov{};
+        iov.iov_base = &marker;
+        iov.iov_len = 1;
+
+        alignas(cmsghdr) char control[CMSG_SPACE(HANDOFF_MAX_FDS_PER_MESSAGE * sizeof(int))] = {};
+        msghdr message{};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), fds.data() + sent, count * sizeof(int));
+
+        if (sendmsg(channel, &message, MSG_NOSIGNAL) != 1) {
+            return false;
+        }
+    }
+
+    for (size_t sent = 0; sent < state.size(); sent += HANDOFF_CHUNK_SIZE) {
+        if (!sendMessage(channel, state.substr(sent, HANDOFF_CHUNK_SIZE))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool HandoffChannel::receive(int channel, std::vector<int>& fds, std::string& state) {
+    std::string header;
+    if (!receiveMessage(channel, header)) {
+        return false;
+    }
+
+    // The state of a server of another version would not parse
+    std::array<std::string_view, 4> tokens;
+    size_t fdCount, stateSize;
+    if (TCPUtils::splitView(header, ';', tokens) != 4 || tokens[0] != "handoff" || tokens[1] != std::to_string(HANDOFF_VERSION) ||
+        !TCPUtils::parseNumber(tokens[2], fdCount) || !TCPUtils::parseNumber(tokens[3], stateSize)) {
+        std::cerr << "Handoff refused : " << header << std::endl;
+        return false;
+    }
+
+    while (fds.size() < fdCount) {
+        char marker;
+        iovec iov{};
+        iov.iov_base = &marker;
+        iov.iov_len = 1;
+
+        alignas(cmsghdr) char control[CMSG_SPACE(HANDOFF_MAX_FDS_PER_MESSAGE * sizeof(int))] = {};
+        msghdr message{};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        if (recvmsg(channel, &message, MSG_CMSG_CLOEXEC) != 1 || (message.msg_flags & MSG_CTRUNC)) {
+            closeAll(fds);
+            return false;
+        }
+
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            size_t first = fds.size();
+            fds.resize(first + count);
+            std::memcpy(fds.data() + first, CMSG_DATA(cmsg), count * sizeof(int));
+        }
+    }
+
+    state.clear();
+    state.reserve(stateSize);
+    std::string chunk;
+    while (state.size() < stateSize) {
+        if (!receiveMessage(channel, chunk)) {
+            closeAll(fds);
+            return false;
+        }
+        state += chunk;
+    }
+    return true;
+}
+
+bool HandoffChannel::sendMessage(int channel, std::string_view message) {
+    return ::send(channel, message.data(), message.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(message.size());
+}
+
+bool HandoffChannel::receiveConfirmation(int channel, std::string& message) {
+    timeval none{};
+    setsockopt(channel, SOL_SOCKET, SO_RCVTIMEO, &none, sizeof(none));
+    return receiveMessage(channel, message);
+}
+
+bool HandoffChannel::receiveMessage(int channel, std::string& message) {
+    message.resize(HANDOFF_CHUNK_SIZE);
+    ssize_t size;
+    do {
+        size = recv(channel, message.data(), message.size(), 0);
+    } while (size == -1 && errno == EINTR);
+
+    if (size <= 0) {
+        message.clear();
+        return false;
+    }
+    message.resize(size);
+    return true;
+}
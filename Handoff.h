@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define HANDOFF_VERSION 3
+#define HANDOFF_MAX_FDS_PER_MESSAGE 250 // SCM_MAX_FD is 253
+#define HANDOFF_CHUNK_SIZE (32 * 1024)
+#define HANDOFF_TIMEOUT_MS 5000
+
+// A live connection passed to the next server
+struct HandoffClient {
+    std::string name; // Empty if it never sent ready
+    int features = 0;
+    bool poseSubscriber = false;
+    uint32_t watchedKeys = 0; // StateKey bits
+    std::vector<std::string> topics; // Subscribed patterns
+    std::string input; // Partial line received and not handled yet
+    std::string output; // Bytes queued and not written yet
+};
+
+/*
+ * Everything the next server needs to carry on without the clients noticing.
+ *
+ * The file descriptors travel beside it in this order : the TCP listen sockets, the unix listen socket
+ * if there is one, then one socket per client.
+ */
+struct HandoffState {
+    size_t listenSockets = 0;
+    bool unixSocket = false;
+    std::vector<HandoffClient> clients;
+    std::map<std::string, std::string, std::less<>> values; // Robot state, formatted by the server
+
+    [[nodiscard]] size_t fdCount() const;
+
+    [[nodiscard]] std::string serialize() const;
+
+    bool parse(std::string_view data);
+};
+
+/*
+ * Unix SOCK_SEQPACKET channel between the running server and the one replacing it.
+ *
+ * The new server connects, the running one stops its reactors and answers "handoff;<version>;<fd count>;<state size>",
+ * or "refused;<reason>". The file descriptors follow with SCM_RIGHTS, a few hundred per message, then the
+ * serialized state in chunks. The new server confirms with "ok" once it owns everything. The running server
+ * waits for it without deadline and only takes over again if the channel closes first, as the new server
+ * does when it cannot confirm.
+ */
+class HandoffChannel {
+public:
+    // Listening socket for the next server, -1 on failure
+    static int listenOn(const std::string& path);
+
+    // Channel to the server running on the path, -1 if there is none
+    static int connectTo(const std::string& path);
+
+    // Set the timeouts of an accepted channel
+    static void setTimeouts(int channel);
+
+    static bool send(int channel, const std::vector<int>& fds, std::string_view state);
+
+    // The file descriptors are received close-on-exec, nothing is kept on failure
+    static bool receive(int channel, std::vector<int>& fds, std::string& state);
+
+    static bool sendMessage(int channel, std::string_view message);
+
+    static bool receiveMessage(int channel, std::string& message);
+
+    // Without timeout, false once the channel is closed
+    static bool receiveConfirmation(int channel, std::string& message);
+};
@@ -0,0 +1,276 @@
+#include "IoUring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+std::unique_ptr<IoUring> IoUring::create(const unsigned entries) {
+    std::unique_ptr<IoUring> uring(new IoUring());
+
+    io_uring_params params{};
+    uring->ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (uring->ringFd == -1) {
+        std::cerr << "io_uring setup failed : " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP) || !uring->supportsOperations()) {
+        std::cerr << "io_uring is too old" << std::endl;
+        return nullptr;
+    }
+
+    // Both rings share one mapping
+    uring->sqRingSize = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                                 params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    uring->sqRing = mmap(nullptr, uring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ringFd, IORING_OFF_SQ_RING);
+    if (uring->sqRing == MAP_FAILED) {
+        uring->sqRing = nullptr;
+        std::cerr << "io_uring ring mapping failed" << std::endl;
+        return nullptr;
+    }
+    uring->cqRing = uring->sqRing;
+
+    uring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, uring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        std::cerr << "io_uring entries mapping failed" << std::endl;
+        return nullptr;
+    }
+    uring->sqes = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(uring->sqRing);
+    uring->sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    uring->sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    uring->sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    uring->sqEntries = params.sq_entries;
+
+    // Entries are always used in order, the indirection array never changes
+    auto* array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++) {
+        array[i] = i;
+    }
+
+    char* cq = static_cast<char*>(uring->cqRing);
+    uring->cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    uring->cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    uring->cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    uring->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    uring->bufferRingSize = IO_URING_BUFFER_COUNT * sizeof(io_uring_buf);
+    void* bufferRing = mmap(nullptr, uring->bufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufferRing == MAP_FAILED) {
+        std::cerr << "io_uring buffer ring allocation failed" << std::endl;
+        return nullptr;
+    }
+    uring->bufferRing = static_cast<io_uring_buf*>(bufferRing);
+
+    io_uring_buf_reg registration{};
+    registration.ring_addr = reinterpret_cast<uint64_t>(bufferRing);
+    registration.ring_entries = IO_URING_BUFFER_COUNT;
+    registration.bgid = IO_URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, uring->ringFd, IORING_REGISTER_PBUF_RING, &registration, 1) == -1) {
+        std::cerr << "io_uring buffer ring registration failed : " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+
+    uring->buffers.resize(IO_URING_BUFFER_COUNT * IO_URING_BUFFER_SIZE);
+    for (uint16_t bufferId = 0; bufferId < IO_URING_BUFFER_COUNT; bufferId++) {
+        uring->addBuffer(bufferId);
+    }
+
+    return uring;
+}
+
+bool IoUring::supportsOperations() const {
+    alignas(io_uring_probe) char storage[sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op)] = {};
+    auto* probe = reinterpret_cast<io_uring_probe*>(storage);
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, 256) == -1) {
+        return false;
+    }
+
+    // Multishot accept and recv are flags, not opcodes, send zerocopy came with the latter in Linux 6.0
+    for (int operation : {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_POLL_ADD,
+                          IORING_OP_ASYNC_CANCEL, IORING_OP_TIMEOUT, IORING_OP_SEND_ZC}) {
+        if (operation >= probe->ops_len || !(probe->ops[operation].flags & IO_URING_OP_SUPPORTED)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+IoUring::~IoUring() {
+    // Closing the ring cancels every operation still armed
+    if (ringFd != -1) {
+        close(ringFd);
+    }
+    if (bufferRing) {
+        munmap(bufferRing, bufferRingSize);
+    }
+    if (sqes) {
+        munmap(sqes, sqesSize);
+    }
+    if (sqRing) {
+        munmap(sqRing, sqRingSize);
+    }
+}
+
+io_uring_sqe* IoUring::nextSqe() {
+    if (!this->reserve(1)) {
+        return nullptr;
+    }
+
+    unsigned tail = *sqTail;
+    io_uring_sqe* sqe = &sqes[tail & sqMask];
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+
+    // Without SQPOLL the kernel only reads the entries during io_uring_enter
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+bool IoUring::reserve(const unsigned count) {
+    if (*sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) + count <= sqEntries) {
+        return true;
+    }
+    return this->submitAndWait(0) && *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) + count <= sqEntries;
+}
+
+bool IoUring::acceptMultishot(const int listenSocket, const uint64_t userData) {
+    io_uring_sqe* sqe = this->nextSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenSocket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IoUring::recvMultishot(const int socket, const uint64_t userData) {
+    io_uring_sqe* sqe = this->nextSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = IO_URING_BUFFER_GROUP;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IoUring::pollMultishot(const int fd, const uint64_t userData) {
+    io_uring_sqe* sqe = this->nextSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IoUring::send(const int socket, const std::string_view data, const uint64_t userData, const bool link) {
+    io_uring_sqe* sqe = this->nextSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = socket;
+    sqe->addr = reinterpret_cast<uint64_t>(data.data());
+    sqe->len = static_cast<uint32_t>(data.size());
+    // A short send would break the chain, the kernel retries until everything is sent
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->flags = link ? IOSQE_IO_LINK : 0;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IoUring::cancel(const uint64_t target, const uint64_t userData) {
+    io_uring_sqe* sqe = this->nextSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IoUring::timeout(const __kernel_timespec& delay, const uint64_t userData) {
+    io_uring_sqe* sqe = this->nextSqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uint64_t>(&delay);
+    sqe->len = 1;
+    sqe->user_data = userData;
+    return true;
+}
+
+bool IoUring::submitAndWait(const unsigned minComplete) {
+    while (true) {
+        unsigned toSubmit = *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0) >= 0) {
+            return true;
+        }
+        if (errno == EINTR) {
+            // Nothing was submitted, the caller loops anyway
+            return true;
+        }
+        if (errno != EAGAIN && errno != EBUSY) {
+            std::cerr << "io_uring enter failed : " << std::strerror(errno) << std::endl;
+            return false;
+        }
+    }
+}
+
+std::string_view IoUring::buffer(const io_uring_cqe& cqe) const {
+    uint16_t bufferId = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+    return {buffers.data() + static_cast<size_t>(bufferId) * IO_URING_BUFFER_SIZE, static_cast<size_t>(std::max(cqe.res, 0))};
+}
+
+void IoUring::recycleBuffer(const io_uring_cqe& cqe) {
+    this->addBuffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+}
+
+void IoUring::addBuffer(const uint16_t bufferId) {
+    io_uring_buf& buffer = bufferRing[bufferTail & (IO_URING_BUFFER_COUNT - 1)];
+    buffer.addr = reinterpret_cast<uint64_t>(buffers.data() + static_cast<size_t>(bufferId) * IO_URING_BUFFER_SIZE);
+    buffer.len = IO_URING_BUFFER_SIZE;
+    buffer.bid = bufferId;
+
+    // The tail of the ring overlays the reserved field of its first entry
+    bufferTail++;
+    __atomic_store_n(&bufferRing[0].resv, bufferTail, __ATOMIC_RELEASE);
+}
+
+uint64_t IoUring::userData(const uint8_t operation, const uint32_t generation, const uint32_t id) {
+    return static_cast<uint64_t>(operation) << 56 | static_cast<uint64_t>(generation & 0xFFFFFF) << 32 | id;
+}
+
+uint8_t IoUring::operationOf(const uint64_t userData) {
+    return userData >> 56;
+}
+
+uint32_t IoUring::generationOf(const uint64_t userData) {
+    return userData >> 32 & 0xFFFFFF;
+}
+
+uint32_t IoUring::idOf(const uint64_t userData) {
+    return static_cast<uint32_t>(userData);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include <linux/io_uring.h>
+
+#define IO_URING_ENTRIES 256
+#define IO_URING_BUFFER_COUNT 256 // Power of two
+#define IO_URING_BUFFER_SIZE 4096
+#define IO_URING_BUFFER_GROUP 0
+
+/*
+ * Minimal io_uring over the raw syscalls, no liburing on the robot.
+ *
+ * Operations are prepared in the submission ring and only reach the kernel with the next submitAndWait,
+ * which also waits for completions, so a whole batch of recv and send costs one syscall.
+ * Multishot recv picks its buffers from a provided buffer ring, they go back with recycleBuffer.
+ * The user_data of an operation packs its type on 8 bits, a generation on 24 bits and an id on 32 bits.
+ */
+class IoUring {
+public:
+    static std::unique_ptr<IoUring> create(unsigned entries = IO_URING_ENTRIES);
+
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+
+    IoUring& operator=(const IoUring&) = delete;
+
+    // Every connection of the listen socket completes with its new socket
+    bool acceptMultishot(int listenSocket, uint64_t userData);
+
+    // Every chunk received completes with a buffer taken from the provided buffer ring
+    bool recvMultishot(int socket, uint64_t userData);
+
+    bool pollMultishot(int fd, uint64_t userData);
+
+    // A linked send starts once the previous one of its chain is done
+    bool send(int socket, std::string_view data, uint64_t userData, bool link);
+
+    bool cancel(uint64_t target, uint64_t userData);
+
+    // Complete with -ETIME after the delay, the timespec is read when the operation is submitted
+    bool timeout(const __kernel_timespec& delay, uint64_t userData);
+
+    // Make room for count operations, a linked chain must not be split between two submissions
+    bool reserve(unsigned count);
+
+    bool submitAndWait(unsigned minComplete);
+
+    // Call onCompletion(const io_uring_cqe&) for every completion ready
+    template<class F>
+    void drain(F&& onCompletion);
+
+    // Data received by a completion flagged IORING_CQE_F_BUFFER
+    [[nodiscard]] std::string_view buffer(const io_uring_cqe& cqe) const;
+
+    void recycleBuffer(const io_uring_cqe& cqe);
+
+    static uint64_t userData(uint8_t operation, uint32_t generation, uint32_t id);
+
+    static uint8_t operationOf(uint64_t userData);
+
+    static uint32_t generationOf(uint64_t userData);
+
+    static uint32_t idOf(uint64_t userData);
+
+private:
+    IoUring() = default;
+
+    // Every operation the server prepares, and multishot recv, which the kernel cannot be asked about
+    [[nodiscard]] bool supportsOperations() const;
+
+    io_uring_sqe* nextSqe();
+
+    void addBuffer(uint16_t bufferId);
+
+    int ringFd = -1;
+
+    void* sqRing = nullptr;
+    size_t sqRingSize = 0;
+    void* cqRing = nullptr; // Same mapping as sqRing
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    // Not io_uring_buf_ring, its flexible array is misplaced when the uapi header is compiled as C++
+    io_uring_buf* bufferRing = nullptr;
+    size_t bufferRingSize = 0;
+    uint16_t bufferTail = 0;
+    std::vector<char> buffers;
+};
+
+template<class F>
+void IoUring::drain(F&& onCompletion) {
+    unsigned head = *cqHead;
+    while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+        onCompletion(cqes[head & cqMask]);
+        head++;
+        // Release each entry right away, the kernel keeps posting while the handler runs
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+}
@@ -0,0 +1,41 @@
+#include "LineFramer.h"
+
+#include <iostream>
+
+LineFramer::LineFramer(const size_t capacity) : buffer(capacity) {}
+
+char* LineFramer::writePtr() {
+    return buffer.data() + tail;
+}
+
+size_t LineFramer::writable() const {
+    return buffer.size() - tail;
+}
+
+void LineFramer::commit(const size_t size) {
+    tail += size;
+}
+
+std::string_view LineFramer::pending() const {
+    return {buffer.data() + head, tail - head};
+}
+
+void LineFramer::compact() {
+    if (head == tail) {
+        head = tail = 0;
+        return;
+    }
+
+    if (head > 0) {
+        std::memmove(buffer.data(), buffer.data() + head, tail - head);
+        tail -= head;
+        head = 0;
+    }
+
+    // No room left and still no '\n': the line can never fit, drop what we have of it
+    if (tail == buffer.size()) {
+        std::cerr << "Message longer than " << buffer.size() << " bytes, dropping it" << std::endl;
+        discarding = true;
+        head = tail = scanned = 0;
+    }
+}
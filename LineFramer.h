@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "BinaryProtocol.h"
+
+#define LINE_FRAMER_CAPACITY 8192
+
+/*
+ * Incremental '\n' framer for a stream socket.
+ *
+ * recv() writes straight into the free tail of the buffer, complete lines are handed out
+ * as views into that same buffer and only the trailing partial line is moved back to the front.
+ * A line longer than the capacity is dropped up to its next '\n'.
+ * A frame starting with BINARY_MAGIC is a binary frame, it is handed out whole once its size is reached.
+ */
+class LineFramer {
+public:
+    explicit LineFramer(size_t capacity = LINE_FRAMER_CAPACITY);
+
+    [[nodiscard]] char* writePtr();
+
+    [[nodiscard]] size_t writable() const;
+
+    void commit(size_t size);
+
+    // Call onLine(std::string_view) for every complete, non-empty line or binary frame, the views are only valid during the call
+    template<class F>
+    void drain(F&& onLine);
+
+    // Bytes received that are not yet part of a complete line
+    [[nodiscard]] std::string_view pending() const;
+
+private:
+    void compact();
+
+    std::vector<char> buffer;
+    size_t head = 0; // Start of the first unconsumed byte
+    size_t tail = 0; // End of the received bytes
+    size_t scanned = 0; // Bytes after head already known to contain no '\n'
+    bool discarding = false; // Skipping the rest of an oversized line
+};
+
+template<class F>
+void LineFramer::drain(F&& onLine) {
+    while (head + scanned < tail) {
+        const char* start = buffer.data() + head;
+
+        if (scanned == 0 && !discarding && *start == BINARY_MAGIC) {
+            size_t size = BinaryProtocol::frameSize(std::string_view(start, tail - head));
+            if (size > buffer.size()) {
+                head++; // Cannot be a real frame, resynchronise on the next byte
+                continue;
+            }
+            if (size == 0 || head + size > tail) {
+                break; // Wait for the rest of the frame
+            }
+
+            onLine(std::string_view(start, size));
+            head += size;
+            continue;
+        }
+        const auto* newline = static_cast<const char*>(std::memchr(start + scanned, '\n', tail - head - scanned));
+
+        if (newline == nullptr) {
+            scanned = tail - head;
+            break;
+        }
+
+        size_t length = newline - start;
+        if (!discarding && length > 0) {
+            onLine(std::string_view(start, length));
+        }
+
+        discarding = false;
+        head += length + 1;
+        scanned = 0;
+    }
+
+    this->compact();
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+
+#include "Frame.h"
+#include "utils.h"
+
+#define MESSAGE_MAX_SIZE 256
+
+/*
+ * Protocol schema, one struct per message with its verb and its comma separated fields in wire order.
+ *
+ * Numbers always travel as integers, a float field is truncated when it is sent and keeps its decimals
+ * when it is parsed. A string_view field points into the parsed message.
+ */
+
+// strat -> arduino
+struct GoMessage {
+    static constexpr std::string_view VERB = "go";
+    int x;
+    int y;
+
+    auto fields() { return std::tie(x, y); }
+    [[nodiscard]] auto fields() const { return std::tie(x, y); }
+};
+
+// strat -> arduino, go without stopping, at endSpeed on arrival
+struct TransitMessage {
+    static constexpr std::string_view VERB = "transit";
+    int x;
+    int y;
+    int endSpeed;
+
+    auto fields() { return std::tie(x, y, endSpeed); }
+    [[nodiscard]] auto fields() const { return std::tie(x, y, endSpeed); }
+};
+
+// strat -> arduino
+struct AngleMessage {
+    static constexpr std::string_view VERB = "angle";
+    float theta; // Radians * 100
+
+    auto fields() { return std::tie(theta); }
+    [[nodiscard]] auto fields() const { return std::tie(theta); }
+};
+
+// strat -> arduino
+struct SpeedMessage {
+    static constexpr std::string_view VERB = "speed";
+    int speed;
+
+    auto fields() { return std::tie(speed); }
+    [[nodiscard]] auto fields() const { return std::tie(speed); }
+};
+
+// Both ways, the pose of the robot
+struct PoseMessage {
+    static constexpr std::string_view VERB = "set pos";
+    float x;
+    float y;
+    float theta; // Radians * 100
+
+    auto fields() { return std::tie(x, y, theta); }
+    [[nodiscard]] auto fields() const { return std::tie(x, y, theta); }
+};
+
+// strat -> any client, the answer to get speed
+struct SetSpeedMessage {
+    static constexpr std::string_view VERB = "set speed";
+    int speed;
+
+    auto fields() { return std::tie(speed); }
+    [[nodiscard]] auto fields() const { return std::tie(speed); }
+};
+
+// strat -> all, a Team value
+struct TeamMessage {
+    static constexpr std::string_view VERB = "set team";
+    int team;
+
+    auto fields() { return std::tie(team); }
+    [[nodiscard]] auto fields() const { return std::tie(team); }
+};
+
+// strat -> ihm
+struct PointMessage {
+    static constexpr std::string_view VERB = "add point";
+    int points;
+
+    auto fields() { return std::tie(points); }
+    [[nodiscard]] auto fields() const { return std::tie(points); }
+};
+
+// strat -> lidar or arduino, answered with set pos
+struct GetPosMessage {
+    static constexpr std::string_view VERB = "get pos";
+    int unused = 1;
+
+    auto fields() { return std::tie(unused); }
+    [[nodiscard]] auto fields() const { return std::tie(unused); }
+};
+
+// strat -> arduino, answered with set state
+struct GetStateMessage {
+    static constexpr std::string_view VERB = "get state";
+    int unused = 1;
+
+    auto fields() { return std::tie(unused); }
+    [[nodiscard]] auto fields() const { return std::tie(unused); }
+};
+
+// strat -> aruco, answered with a list of ArucoTagMessage or 404
+struct GetArucoMessage {
+    static constexpr std::string_view VERB = "get aruco";
+    int unused = 1;
+
+    auto fields() { return std::tie(unused); }
+    [[nodiscard]] auto fields() const { return std::tie(unused); }
+};
+
+// aruco -> strat, one tag of the answer to get aruco
+struct ArucoTagMessage {
+    static constexpr std::string_view VERB = "get aruco";
+    int id;
+    std::string_view name;
+    float x;
+    float y;
+    float rotX;
+    float rotY;
+    float rotZ;
+
+    auto fields() { return std::tie(id, name, x, y, rotX, rotY, rotZ); }
+    [[nodiscard]] auto fields() const { return std::tie(id, name, x, y, rotX, rotY, rotZ); }
+};
+
+/*
+ * Codecs of the schema, they write into a caller buffer and parse views of the received line without allocating.
+ */
+namespace Messages {
+    // Room for any message of the schema
+    using Buffer = std::array<char, MESSAGE_MAX_SIZE>;
+
+    class Writer {
+    public:
+        explicit Writer(Buffer& buffer) : begin(buffer.data()), pos(buffer.data()), end(buffer.data() + buffer.size()) {}
+
+        void put(const std::string_view text) {
+            if (static_cast<size_t>(end - pos) < text.size()) {
+                overflow = true;
+                return;
+            }
+            std::memcpy(pos, text.data(), text.size());
+            pos += text.size();
+        }
+
+        template<class T>
+        void putField(const T& value) {
+            if constexpr (std::is_same_v<T, std::string_view>) {
+                this->put(value);
+            } else if constexpr (std::is_floating_point_v<T>) {
+                this->putField(static_cast<long long>(value));
+            } else {
+                auto [ptr, ec] = std::to_chars(pos, end, value);
+                if (ec != std::errc()) {
+                    overflow = true;
+                    return;
+                }
+                pos = ptr;
+            }
+        }
+
+        // Empty if the buffer was too small
+        [[nodiscard]] std::string_view written() const {
+            return overflow ? std::string_view() : std::string_view(begin, pos - begin);
+        }
+
+    private:
+        char* begin;
+        char* pos;
+        char* end;
+        bool overflow = false;
+    };
+
+    template<class Message>
+    void writeFields(Writer& writer, const Message& message) {
+        std::apply([&writer](const auto&... fields) {
+            bool first = true;
+            ((writer.put(first ? "" : ","), writer.putField(fields), first = false), ...);
+        }, message.fields());
+    }
+
+    // The fields alone, as they follow the verb
+    template<class Message>
+    std::string_view encodeFields(const Message& message, Buffer& buffer) {
+        Writer writer(buffer);
+        writeFields(writer, message);
+        return writer.written();
+    }
+
+    // The whole line "sender;receiver;verb;fields\n"
+    template<class Message>
+    std::string_view encode(const std::string_view sender, const std::string_view receiver, const Message& message, Buffer& buffer) {
+        Writer writer(buffer);
+        writer.put(sender);
+        writer.put(";");
+        writer.put(receiver);
+        writer.put(";");
+        writer.put(Message::VERB);
+        writer.put(";");
+        writeFields(writer, message);
+        writer.put("\n");
+        return writer.written();
+    }
+
+    // For a message sent many times or to many clients, serialized once
+    template<class Message>
+    FramePtr toFrame(const std::string_view sender, const std::string_view receiver, const Message& message) {
+        Buffer buffer;
+        return Frame::fromMessage(encode(sender, receiver, message, buffer));
+    }
+
+    template<class T>
+    bool parseField(std::string_view& args, T& value) {
+        std::string_view token;
+        if (!TCPUtils::nextToken(args, ',', token)) {
+            return false;
+        }
+        if constexpr (std::is_same_v<T, std::string_view>) {
+            value = token;
+            return true;
+        } else {
+            return TCPUtils::parseNumber(token, value);
+        }
+    }
+
+    // Parse the fields of one message off the front of args, for the answers that list several
+    template<class Message>
+    bool decodeNext(std::string_view& args, Message& message) {
+        return std::apply([&args](auto&... fields) { return (parseField(args, fields) && ...); }, message.fields());
+    }
+
+    // Exactly the fields of the message
+    template<class Message>
+    bool decode(std::string_view args, Message& message) {
+        return decodeNext(args, message) && args.empty();
+    }
+}
@@ -0,0 +1,175 @@
+#include "OutboundQueue.h"
+
+#include <cerrno>
+#include <sys/uio.h>
+
+OutboundQueue::OutboundQueue(const size_t maxBytes) : maxBytes(maxBytes) {}
+
+bool OutboundQueue::push(const FramePtr& frame) {
+    std::lock_guard lock(mutex);
+
+    Entry entry = entryOf(frame);
+    if (bytesOf(entry).size() > maxFrameSize) {
+        return false;
+    }
+
+    if (!frame->topic.empty()) {
+        auto it = pendingTopics.find(frame->topic);
+        if (it != pendingTopics.end()) {
+            size_t index = it->second - frontSequence;
+            // The first frame may already be half written, it has to go out as is
+            if (it->second >= afterBarrier && (index > 0 || headOffset == 0)) {
+                queuedBytes = queuedBytes - bytesOf(frames[index]).size() + bytesOf(entry).size();
+                frames[index] = std::move(entry);
+                return true;
+            }
+        }
+    }
+
+    if (queuedBytes + bytesOf(entry).size() > maxBytes) {
+        return false;
+    }
+
+    queuedBytes += bytesOf(entry).size();
+    frames.push_back(std::move(entry));
+    if (!frame->topic.empty()) {
+        pendingTopics[frame->topic] = frontSequence + frames.size() - 1;
+    } else {
+        afterBarrier = frontSequence + frames.size();
+    }
+    return true;
+}
+
+void OutboundQueue::popFront() {
+    const FramePtr& frame = frames.front().frame;
+    if (!frame->topic.empty()) {
+        auto it = pendingTopics.find(frame->topic);
+        if (it != pendingTopics.end() && it->second == frontSequence) {
+            pendingTopics.erase(it);
+        }
+    }
+
+    frames.pop_front();
+    frontSequence++;
+    headOffset = 0;
+}
+
+OutboundQueue::FlushResult OutboundQueue::flush(const int socket) {
+    std::lock_guard lock(mutex);
+    scheduled = false;
+
+    while (!frames.empty()) {
+        iovec iov[OUTBOUND_QUEUE_MAX_IOV];
+        int iovCount = 0;
+        for (auto it = frames.begin(); it != frames.end() && iovCount < OUTBOUND_QUEUE_MAX_IOV; ++it, ++iovCount) {
+            size_t offset = iovCount == 0 ? headOffset : 0;
+            const std::string& bytes = bytesOf(*it);
+            iov[iovCount].iov_base = const_cast<char*>(bytes.data()) + offset;
+            iov[iovCount].iov_len = bytes.size() - offset;
+        }
+
+        ssize_t written = writev(socket, iov, iovCount);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? PENDING : FAILED;
+        }
+
+        queuedBytes -= written;
+        while (written > 0) {
+            size_t left = bytesOf(frames.front()).size() - headOffset;
+            if (static_cast<size_t>(written) < left) {
+                headOffset += written;
+                break;
+            }
+            written -= static_cast<ssize_t>(left);
+            this->popFront();
+        }
+    }
+
+    return FLUSHED;
+}
+
+OutboundQueue::FlushResult OutboundQueue::flush(ShmRing& ring) {
+    std::lock_guard lock(mutex);
+    scheduled = false;
+
+    while (!frames.empty()) {
+        std::string_view bytes = bytesOf(frames.front());
+        bytes.remove_prefix(headOffset);
+        // Queued before the limit was set
+        if (bytes.size() > ring.capacity()) {
+            queuedBytes -= bytes.size();
+            this->popFront();
+            continue;
+        }
+        if (!ring.push(bytes)) {
+            return ring.corrupted() ? FAILED : PENDING;
+        }
+
+        queuedBytes -= bytes.size();
+        this->popFront();
+    }
+
+    return FLUSHED;
+}
+
+size_t OutboundQueue::take(std::vector<FramePtr>& taken, std::vector<std::string_view>& bytes, const size_t maxFrames) {
+    std::lock_guard lock(mutex);
+    scheduled = false;
+
+    size_t count = 0;
+    while (!frames.empty() && count < maxFrames) {
+        std::string_view frameBytes = bytesOf(frames.front());
+        frameBytes.remove_prefix(headOffset);
+
+        taken.push_back(frames.front().frame);
+        bytes.push_back(frameBytes);
+        queuedBytes -= frameBytes.size();
+        this->popFront();
+        count++;
+    }
+
+    return count;
+}
+
+std::string OutboundQueue::unsent() {
+    std::lock_guard lock(mutex);
+    std::string bytes;
+    bytes.reserve(queuedBytes);
+    for (auto it = frames.begin(); it != frames.end(); ++it) {
+        bytes.append(bytesOf(*it), it == frames.begin() ? headOffset : 0);
+    }
+    return bytes;
+}
+
+void OutboundQueue::limitFrameSize(const size_t size) {
+    std::lock_guard lock(mutex);
+    maxFrameSize = size;
+}
+
+bool OutboundQueue::schedule() {
+    std::lock_guard lock(mutex);
+    if (scheduled) {
+        return false;
+    }
+    scheduled = true;
+    return true;
+}
+
+size_t OutboundQueue::size() {
+    std::lock_guard lock(mutex);
+    return frames.size();
+}
+
+void OutboundQueue::setBinary(const bool binary) {
+    std::lock_guard lock(mutex);
+    this->binary = binary;
+}
+
+OutboundQueue::Entry OutboundQueue::entryOf(const FramePtr& frame) const {
+    return {frame, binary && !frame->binary().empty()};
+}
+
+const std::string& OutboundQueue::bytesOf(const Entry& entry) {
+    return entry.binary ? entry.frame->binary() : entry.frame->text;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Frame.h"
+#include "ShmTransport.h"
+
+#define OUTBOUND_QUEUE_MAX_BYTES (256 * 1024)
+#define OUTBOUND_QUEUE_MAX_IOV 64
+
+/*
+ * Bounded queue of frames waiting to be written on one client socket.
+ *
+ * Any thread can push, only the reactor flushes, with writev so that many small lines leave in one syscall.
+ * A frame with a topic replaces the pending frame of the same topic instead of queueing behind it,
+ * so a slow client only ever gets the newest pose or speed. It only does so while no frame without
+ * topic was pushed since, a newer value never overtakes a command.
+ */
+class OutboundQueue {
+public:
+    enum FlushResult {
+        FLUSHED, // Everything was written
+        PENDING, // The socket is full, wait for EPOLLOUT
+        FAILED,  // The socket is broken
+    };
+
+    explicit OutboundQueue(size_t maxBytes = OUTBOUND_QUEUE_MAX_BYTES);
+
+    // Never block on the socket, return false and drop the frame if the queue is full or the frame too large
+    bool push(const FramePtr& frame);
+
+    FlushResult flush(int socket);
+
+    // Move whole frames into a shared memory ring, PENDING once it is full, FAILED once it is corrupted
+    FlushResult flush(ShmRing& ring);
+
+    // Refuse frames larger than a shared memory ring, they would never fit
+    void limitFrameSize(size_t size);
+
+    // Hand up to maxFrames frames over to an asynchronous writer, it keeps them alive until they are sent
+    size_t take(std::vector<FramePtr>& taken, std::vector<std::string_view>& bytes, size_t maxFrames);
+
+    // Bytes not written yet, starting with the rest of a half written frame
+    [[nodiscard]] std::string unsent();
+
+    // Mark the queue as waiting for a flush, return false if it already was
+    bool schedule();
+
+    [[nodiscard]] size_t size();
+
+    // Send the binary form of the frames that have one, from the next frame pushed on
+    void setBinary(bool binary);
+
+private:
+    // The encoding is chosen when the frame is pushed, a frame never changes it while being written
+    struct Entry {
+        FramePtr frame;
+        bool binary;
+    };
+
+    std::mutex mutex;
+    void popFront();
+
+    [[nodiscard]] Entry entryOf(const FramePtr& frame) const;
+
+    [[nodiscard]] static const std::string& bytesOf(const Entry& entry);
+
+    std::deque<Entry> frames;
+    uint64_t frontSequence = 0; // Sequence number of frames.front()
+    uint64_t afterBarrier = 0; // Sequence number following the last frame without topic
+    std::unordered_map<std::string, uint64_t> pendingTopics; // Topic -> sequence number of its queued frame
+    size_t headOffset = 0; // Bytes of the first frame already written
+    size_t queuedBytes = 0;
+    size_t maxBytes;
+    size_t maxFrameSize = SIZE_MAX;
+    bool scheduled = false;
+    bool binary = false;
+};
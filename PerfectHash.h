@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+#define PERFECT_HASH_MAX_SEED 100000
+
+namespace PerfectHashing {
+    // FNV-1a started from the seed, with a final mix so that the low bits depend on every character
+    constexpr uint32_t hash(const uint32_t seed, const std::string_view key) {
+        uint32_t h = (2166136261u ^ seed) * 16777619u;
+        for (char c : key) {
+            h ^= static_cast<uint8_t>(c);
+            h *= 16777619u;
+        }
+        h ^= h >> 16;
+        h *= 0x45d9f3bu;
+        h ^= h >> 16;
+        return h;
+    }
+
+    // Four slots per key keep the seed search short
+    constexpr size_t tableSize(const size_t keys) {
+        size_t size = 1;
+        while (size < keys * 4) {
+            size <<= 1;
+        }
+        return size;
+    }
+}
+
+/*
+ * Collision free hash table over a fixed set of keys, built at compile time.
+ *
+ * The constructor tries seeds until every key lands in its own slot, declare it constexpr and a key set
+ * with no such seed, duplicates for instance, fails to compile. A lookup is one hash and one comparison.
+ */
+template<size_t N>
+class PerfectHash {
+public:
+    constexpr explicit PerfectHash(const std::array<std::string_view, N>& keys) : keys(keys) {
+        while (!this->fill()) {
+            if (++seed == PERFECT_HASH_MAX_SEED) {
+                throw std::logic_error("No perfect hash for these keys");
+            }
+        }
+    }
+
+    // Index of the key in the array given to the constructor, -1 if it is not one of them
+    [[nodiscard]] constexpr int find(const std::string_view key) const {
+        int index = slots[PerfectHashing::hash(seed, key) & (SIZE - 1)];
+        return index != -1 && keys[index] == key ? index : -1;
+    }
+
+private:
+    static constexpr size_t SIZE = PerfectHashing::tableSize(N);
+
+    constexpr bool fill() {
+        for (auto& slot : slots) {
+            slot = -1;
+        }
+        for (size_t i = 0; i < N; i++) {
+            int& slot = slots[PerfectHashing::hash(seed, keys[i]) & (SIZE - 1)];
+            if (slot != -1) {
+                return false;
+            }
+            slot = static_cast<int>(i);
+        }
+        return true;
+    }
+
+    std::array<std::string_view, N> keys;
+    std::array<int, SIZE> slots{};
+    uint32_t seed = 0;
+};
@@ -0,0 +1,64 @@
+#include "RequestTracker.h"
+
+#include "utils.h"
+
+Reply::Reply(RequestTracker& tracker, const int id, std::future<std::string> future, const std::chrono::steady_clock::time_point deadline)
+    : tracker(tracker), _id(id), future(std::move(future)), deadline(deadline) {}
+
+std::optional<std::string> Reply::get() {
+    if (!future.valid()) {
+        return std::nullopt;
+    }
+
+    if (future.wait_until(deadline) != std::future_status::ready) {
+        tracker.cancel(_id);
+        return std::nullopt;
+    }
+    return future.get();
+}
+
+int Reply::id() const {
+    return _id;
+}
+
+int RequestTracker::add(const std::string_view destination, const std::string_view verb, std::promise<std::string> promise) {
+    std::lock_guard lock(mutex);
+    int id = nextId++;
+    pending.push_back({id, std::string(destination), std::string(verb), std::move(promise)});
+    return id;
+}
+
+bool RequestTracker::complete(const std::string_view sender, const std::string_view verb, const std::string_view args, const std::optional<int> id) {
+    std::lock_guard lock(mutex);
+    for (auto it = pending.begin(); it != pending.end(); ++it) {
+        bool match = id.has_value() ? it->id == *id : it->destination == sender && answers(it->verb, verb);
+        if (match) {
+            it->promise.set_value(std::string(args));
+            pending.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+void RequestTracker::cancel(const int id) {
+    std::lock_guard lock(mutex);
+    pending.remove_if([id](const PendingRequest& request) { return request.id == id; });
+}
+
+bool RequestTracker::hasPending(const std::string_view destination) {
+    std::lock_guard lock(mutex);
+    for (const auto& request : pending) {
+        if (request.destination == destination) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RequestTracker::answers(const std::string_view requestVerb, const std::string_view replyVerb) {
+    if (requestVerb == replyVerb) {
+        return true;
+    }
+    return TCPUtils::startWith(requestVerb, "get ") && TCPUtils::startWith(replyVerb, "set ") && requestVerb.substr(4) == replyVerb.substr(4);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <future>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+class RequestTracker;
+
+// Answer of a request sent with TCPServer::request, get() waits at most until the request deadline
+class Reply {
+public:
+    Reply(RequestTracker& tracker, int id, std::future<std::string> future, std::chrono::steady_clock::time_point deadline);
+
+    // Arguments of the answer, std::nullopt if it did not come in time
+    std::optional<std::string> get();
+
+    [[nodiscard]] int id() const;
+
+private:
+    RequestTracker& tracker;
+    int _id;
+    std::future<std::string> future;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+/*
+ * Outstanding requests waiting for their answer.
+ *
+ * An answer carrying the correlation id (fifth field) completes exactly its request. Answers from clients that
+ * do not echo the id complete the oldest request sent to them whose verb matches ("get pos" is answered by "set pos").
+ */
+class RequestTracker {
+public:
+    // Register a request and return its correlation id
+    int add(std::string_view destination, std::string_view verb, std::promise<std::string> promise);
+
+    // Complete the request answered by this message, return false if nobody was waiting for it
+    bool complete(std::string_view sender, std::string_view verb, std::string_view args, std::optional<int> id);
+
+    void cancel(int id);
+
+    [[nodiscard]] bool hasPending(std::string_view destination);
+
+private:
+    struct PendingRequest {
+        int id;
+        std::string destination;
+        std::string verb;
+        std::promise<std::string> promise;
+    };
+
+    static bool answers(std::string_view requestVerb, std::string_view replyVerb);
+
+    std::mutex mutex;
+    std::list<PendingRequest> pending;
+    int nextId = 1;
+};
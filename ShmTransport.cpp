@@ -0,0 +1,163 @@
+#include "ShmTransport.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+ShmRing::ShmRing(void* memory, const size_t capacity)
+    : header(new (memory) ShmRingHeader()), data(static_cast<char*>(memory) + sizeof(ShmRingHeader)), mask(capacity - 1) {
+    header->head.store(0, std::memory_order_relaxed);
+    header->tail.store(0, std::memory_order_relaxed);
+    header->capacity = capacity;
+}
+
+bool ShmRing::used(const uint64_t head, const uint64_t tail, size_t& bytes) {
+    if (broken || head - tail > capacity()) {
+        broken = true;
+        return false;
+    }
+    bytes = head - tail;
+    return true;
+}
+
+bool ShmRing::push(const std::string_view frame) {
+    uint64_t head = header->head.load(std::memory_order_relaxed);
+    size_t pending;
+    if (!used(head, header->tail.load(std::memory_order_acquire), pending) || frame.size() > capacity() - pending) {
+        return false;
+    }
+
+    size_t offset = head & mask;
+    size_t first = std::min(frame.size(), capacity() - offset);
+    std::memcpy(data + offset, frame.data(), first);
+    std::memcpy(data, frame.data() + first, frame.size() - first);
+
+    header->head.store(head + frame.size(), std::memory_order_release);
+    return true;
+}
+
+size_t ShmRing::read(char* out, const size_t size) {
+    uint64_t tail = header->tail.load(std::memory_order_relaxed);
+    size_t available;
+    if (!used(header->head.load(std::memory_order_acquire), tail, available)) {
+        return 0;
+    }
+    size_t toRead = std::min(size, available);
+
+    size_t offset = tail & mask;
+    size_t first = std::min(toRead, capacity() - offset);
+    std::memcpy(out, data + offset, first);
+    std::memcpy(out + first, data, toRead - first);
+
+    header->tail.store(tail + toRead, std::memory_order_release);
+    return toRead;
+}
+
+size_t ShmRing::capacity() const {
+    return mask + 1;
+}
+
+bool ShmRing::corrupted() const {
+    return broken;
+}
+
+size_t ShmRing::mappingSize(const size_t capacity) {
+    return sizeof(ShmRingHeader) + capacity;
+}
+
+std::unique_ptr<ShmTransport> ShmTransport::create(const size_t requestedCapacity) {
+    size_t capacity = SHM_RING_MIN_CAPACITY;
+    while (capacity < requestedCapacity && capacity < SHM_RING_MAX_CAPACITY) {
+        capacity *= 2;
+    }
+
+    std::unique_ptr<ShmTransport> transport(new ShmTransport());
+    transport->_capacity = capacity;
+    transport->mappedSize = 2 * ShmRing::mappingSize(capacity);
+
+    transport->memoryFd = memfd_create("socketServer-ring", MFD_CLOEXEC);
+    if (transport->memoryFd == -1 || ftruncate(transport->memoryFd, static_cast<off_t>(transport->mappedSize)) == -1) {
+        std::cerr << "Shared memory creation failed" << std::endl;
+        return nullptr;
+    }
+
+    transport->memory = mmap(nullptr, transport->mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, transport->memoryFd, 0);
+    if (transport->memory == MAP_FAILED) {
+        transport->memory = nullptr;
+        std::cerr << "Shared memory mapping failed" << std::endl;
+        return nullptr;
+    }
+
+    transport->serverEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    transport->clientEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (transport->serverEventFd == -1 || transport->clientEventFd == -1) {
+        std::cerr << "Shared memory eventfd creation failed" << std::endl;
+        return nullptr;
+    }
+
+    auto* base = static_cast<char*>(transport->memory);
+    transport->inboundRing = ShmRing(base, capacity);
+    transport->outboundRing = ShmRing(base + ShmRing::mappingSize(capacity), capacity);
+
+    return transport;
+}
+
+ShmTransport::~ShmTransport() {
+    if (memory != nullptr) munmap(memory, mappedSize);
+    if (memoryFd != -1) close(memoryFd);
+    if (serverEventFd != -1) close(serverEventFd);
+    if (clientEventFd != -1) close(clientEventFd);
+}
+
+bool ShmTransport::sendHandshake(const int socket, const std::string_view reply) const {
+    int fds[3] = {memoryFd, serverEventFd, clientEventFd};
+
+    iovec iov{};
+    iov.iov_base = const_cast<char*>(reply.data());
+    iov.iov_len = reply.size();
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    return sendmsg(socket, &message, MSG_NOSIGNAL) == static_cast<ssize_t>(reply.size());
+}
+
+ShmRing& ShmTransport::inbound() {
+    return inboundRing;
+}
+
+ShmRing& ShmTransport::outbound() {
+    return outboundRing;
+}
+
+int ShmTransport::serverEvent() const {
+    return serverEventFd;
+}
+
+void ShmTransport::notifyClient() const {
+    eventfd_write(clientEventFd, 1);
+}
+
+void ShmTransport::acknowledge() const {
+    eventfd_t value;
+    eventfd_read(serverEventFd, &value);
+}
+
+size_t ShmTransport::capacity() const {
+    return _capacity;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#define SHM_RING_MIN_CAPACITY 4096
+#define SHM_RING_MAX_CAPACITY (1024 * 1024)
+
+// Layout shared with the client : head at 0, tail at 64, capacity at 128, data at 192
+// The client can write anything there, the server only trusts its own copy of the capacity
+struct ShmRingHeader {
+    alignas(64) std::atomic<uint64_t> head; // Bytes written so far by the producer
+    alignas(64) std::atomic<uint64_t> tail; // Bytes read so far by the consumer
+    alignas(64) uint64_t capacity; // Power of two
+};
+
+static_assert(sizeof(ShmRingHeader) == 192, "The ring layout is part of the protocol");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "The ring is shared between processes");
+
+// Single producer, single consumer byte ring living in shared memory
+class ShmRing {
+public:
+    ShmRing() = default;
+
+    ShmRing(void* memory, size_t capacity);
+
+    // Write the whole frame or nothing
+    bool push(std::string_view frame);
+
+    // Copy up to size bytes out of the ring, return the number of bytes read
+    size_t read(char* out, size_t size);
+
+    [[nodiscard]] size_t capacity() const;
+
+    // The peer moved head or tail further apart than the capacity, nothing is copied any more
+    [[nodiscard]] bool corrupted() const;
+
+    static size_t mappingSize(size_t capacity);
+
+private:
+    // Bytes written and not read yet, false if head and tail are out of bounds
+    bool used(uint64_t head, uint64_t tail, size_t& bytes);
+
+    ShmRingHeader* header = nullptr;
+    char* data = nullptr;
+    uint64_t mask = 0;
+    bool broken = false;
+};
+
+/*
+ * Shared memory transport negotiated over a unix socket connection with "shm;<capacity>".
+ *
+ * One memfd holds two rings, client -> server first then server -> client. Each side rings the eventfd of the
+ * other after writing into a ring and after freeing space in it. The server replies with "shm;<capacity>"
+ * and passes the memfd, the server eventfd and the client eventfd with SCM_RIGHTS.
+ */
+class ShmTransport {
+public:
+    static std::unique_ptr<ShmTransport> create(size_t requestedCapacity);
+
+    ~ShmTransport();
+
+    ShmTransport(const ShmTransport&) = delete;
+
+    ShmTransport& operator=(const ShmTransport&) = delete;
+
+    // Send the reply and the three file descriptors to the client
+    bool sendHandshake(int socket, std::string_view reply) const;
+
+    ShmRing& inbound();
+
+    ShmRing& outbound();
+
+    // Readable when the client wrote to the inbound ring or freed space in the outbound one
+    [[nodiscard]] int serverEvent() const;
+
+    void notifyClient() const;
+
+    // Reset the server eventfd before draining
+    void acknowledge() const;
+
+    [[nodiscard]] size_t capacity() const;
+
+private:
+    ShmTransport() = default;
+
+    int memoryFd = -1;
+    int serverEventFd = -1;
+    int clientEventFd = -1;
+    void* memory = nullptr;
+    size_t mappedSize = 0;
+    size_t _capacity = 0;
+    ShmRing inboundRing;
+    ShmRing outboundRing;
+};
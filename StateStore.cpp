@@ -0,0 +1,50 @@
+#include "StateStore.h"
+
+#include <algorithm>
+
+uint64_t StateStore::set(const StateKey key, std::string value,
+                         const std::function<void(uint64_t, const std::string&)>& onChange) {
+    std::lock_guard lock(mutex);
+    StateValue& current = values[key];
+    if (current.version != 0 && current.value == value) {
+        return 0;
+    }
+
+    current.value = std::move(value);
+    current.version = ++lastVersion;
+    if (onChange) {
+        onChange(current.version, current.value);
+    }
+    return current.version;
+}
+
+StateValue StateStore::get(const StateKey key) {
+    std::lock_guard lock(mutex);
+    return values[key];
+}
+
+std::vector<std::pair<StateKey, StateValue>> StateStore::changedSince(const uint64_t since, const uint32_t keys) {
+    std::lock_guard lock(mutex);
+    std::vector<std::pair<StateKey, StateValue>> changed;
+    for (int key = 0; key < STATE_KEY_COUNT; key++) {
+        if ((keys & (1u << key)) && values[key].version > since) {
+            changed.emplace_back(static_cast<StateKey>(key), values[key]);
+        }
+    }
+    return changed;
+}
+
+void StateStore::restore(const StateKey key, StateValue value) {
+    std::lock_guard lock(mutex);
+    lastVersion = std::max(lastVersion, value.version);
+    values[key] = std::move(value);
+}
+
+int StateStore::keyOf(const std::string_view name) {
+    for (int key = 0; key < STATE_KEY_COUNT; key++) {
+        if (STATE_KEYS[key] == name) {
+            return key;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// State the server knows without asking the devices, named on the wire by STATE_KEYS
+enum StateKey {
+    STATE_POSE, // x,y,theta*100 as in set pos
+    STATE_LIDAR_POSE, // Last position computed by the lidar, same format
+    STATE_SPEED,
+    STATE_TEAM,
+    STATE_PINCE, // PinceState of the three pinces
+    STATE_PHASE, // waiting, ready or running
+    STATE_SCORE, // Sum of the points sent to the ihm
+    STATE_ARUCO, // id,name,x,y,rx,ry,rz of every tag found, one after the other
+    STATE_KEY_COUNT,
+};
+
+constexpr std::array<std::string_view, STATE_KEY_COUNT> STATE_KEYS = {
+    "pos", "lidar pos", "speed", "team", "pince", "phase", "score", "aruco",
+};
+
+#define STATE_ALL_KEYS ((1u << STATE_KEY_COUNT) - 1)
+
+struct StateValue {
+    uint64_t version = 0; // 0 until the key is first set
+    std::string value;
+};
+
+/*
+ * Last value of each state key with the version it was set at.
+ *
+ * Versions come from a single counter shared by every key, a client that saw version N only needs the keys
+ * changed since N to catch up.
+ */
+class StateStore {
+public:
+    // Return the version of the new value, 0 if the key already had this value
+    // onChange(version, value) runs under the lock, so what it publishes leaves in version order
+    uint64_t set(StateKey key, std::string value,
+                 const std::function<void(uint64_t, const std::string&)>& onChange = nullptr);
+
+    StateValue get(StateKey key);
+
+    // Keys of the mask set after the version since, in key order
+    std::vector<std::pair<StateKey, StateValue>> changedSince(uint64_t since, uint32_t keys);
+
+    // Take a value over from another server, with its version
+    void restore(StateKey key, StateValue value);
+
+    // -1 if no key has this name
+    static int keyOf(std::string_view name);
+
+private:
+    std::mutex mutex;
+    std::array<StateValue, STATE_KEY_COUNT> values;
+    uint64_t lastVersion = 0;
+};
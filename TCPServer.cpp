@@ -1,55 +1,552 @@
 #include "TCPServer.h"
 
-ClientHandler::ClientHandler(int clientSocket, TCPServer* server) : clientSocket(clientSocket), server(server) {};
+#include "PerfectHash.h"
+
+namespace {
+    // Every verb the server handles, a handler can only be registered for these
+    constexpr std::array<std::string_view, 19> COMMAND_VERBS = {
+        "set state", "ready", "get pos", "get value", "watch values", "unwatch values", "subscribe", "unsubscribe",
+        "get speed", "shm", "subscribe pos", "unsubscribe pos", "spawn", "start", "get aruco", "set speed",
+        "set pos", "subscribed pos", "test aruco",
+    };
+    constexpr PerfectHash<COMMAND_VERBS.size()> COMMAND_HASH(COMMAND_VERBS);
+
+    // One column per participant, then the handlers of any sender
+    constexpr uint8_t COMMAND_ANY_SENDER = PARTICIPANTS.size();
+    constexpr size_t COMMAND_SENDERS = PARTICIPANTS.size() + 1;
+
+    // Set by each reactor thread to its arena
+    thread_local std::pmr::memory_resource* reactorArena = nullptr;
+}
 
-void ClientHandler::handle() {
-    std::string buffer;
-    buffer.reserve(8192); // Pre-allocate memory to avoid frequent allocations
+ClientHandler::ClientHandler(int clientSocket, TCPServer* server) : clientSocket(clientSocket), server(server) {};
 
+bool ClientHandler::handle() {
     while (true) {
-        char tempBuffer[8192] = {0};
-        ssize_t valread = recv(clientSocket, tempBuffer, sizeof(tempBuffer), 0);
+        ssize_t valread = recv(clientSocket, framer.writePtr(), framer.writable(), 0);
 
         if (valread > 0) {
-            buffer.append(tempBuffer, valread);
+            framer.commit(valread);
 
-            if (buffer == "quit") {
-                std::cerr << "Client requested to quit. Closing connection." << std::endl;
-                break;
+            if (!processFramed()) {
+                return false;
             }
-
-            std::vector<std::string> messages = TCPUtils::split(buffer, "\n");
-            for (const std::string& message : messages) {
-                processMessage(message);
-            }
-
-            buffer.clear();
         } else if (valread == 0) {
             std::cout << "Client disconnected. " << clientSocket << std::endl;
-            break; // Client disconnected
-        } else {
+            closeConnection();
+            return false; // Client disconnected
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true; // Nothing more to read for now
+        } else if (errno != EINTR) {
             std::cerr << "Failed to receive data." << this->clientSocket << std::endl;
-            break; // Error in receiving data
+            closeConnection();
+            return false; // Error in receiving data
         }
     }
+}
+
+bool ClientHandler::handleSharedMemory() {
+    shm->acknowledge();
+
+    size_t valread;
+    while ((valread = shm->inbound().read(framer.writePtr(), framer.writable())) > 0) {
+        framer.commit(valread);
+
+        if (!processFramed()) {
+            return false;
+        }
+    }
+
+    if (shm->inbound().corrupted()) {
+        std::cerr << "Shared memory ring of client " << this->clientSocket << " is corrupted" << std::endl;
+        closeConnection();
+        return false;
+    }
+    return true;
+}
+
+bool ClientHandler::handleReceived(std::string_view data) {
+    while (!data.empty()) {
+        size_t size = std::min(data.size(), framer.writable());
+        std::memcpy(framer.writePtr(), data.data(), size);
+        framer.commit(size);
+        data.remove_prefix(size);
+
+        if (!processFramed()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ClientHandler::processFramed() {
+    bool quit = false;
+    framer.drain([this, &quit](std::string_view message) {
+        if (message == "quit") {
+            quit = true;
+        } else if (!quit) {
+            processMessage(message);
+        }
+    });
+
+    if (quit || framer.pending() == "quit") {
+        std::cerr << "Client requested to quit. Closing connection." << std::endl;
+        closeConnection();
+        return false;
+    }
+    return true;
+}
 
-    closeConnection();
+std::string_view ClientHandler::pendingInput() const {
+    return framer.pending();
 }
 
-void ClientHandler::processMessage(const std::string& message) {
-    server->handleMessage(message, clientSocket);
+void ClientHandler::processMessage(const std::string_view message) {
+    server->dispatchMessage(message, clientSocket);
 }
 
 void ClientHandler::closeConnection() {
-    close(clientSocket);
+    // Unregister first, once closed the fd can be reused by a connection another reactor accepts
     server->clientDisconnected(clientSocket); // Inform the server that the client has disconnected
+    close(clientSocket);
 }
 
-TCPServer::TCPServer(int port) : team(TEST)
+TCPServer::TCPServer(int port, const std::string& unixSocketPath, IoBackend ioBackend, int reactorCount, int listenFd, const std::string& handoffSocketPath)
+    : unixSocketPath(unixSocketPath), handoffSocketPath(handoffSocketPath), team(TEST)
 {
     this->robotPose = {500, 500, -3.1415/2};
 
-    serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+    this->registerCommands();
+
+    HandoffState handoff;
+    std::vector<int> handoffFds;
+    int handoffChannel = handoffSocketPath.empty() ? -1 : HandoffChannel::connectTo(handoffSocketPath);
+    if (handoffChannel != -1) {
+        this->takeOver(handoffChannel, handoff, handoffFds);
+    }
+
+    std::vector<int> listenSockets(handoffFds.begin(), handoffFds.begin() + handoff.listenSockets);
+    size_t nextFd = handoff.listenSockets;
+    int handedUnixSocket = handoff.unixSocket ? handoffFds[nextFd++] : -1;
+
+    if (listenFd != -1) {
+        if (listenSockets.empty()) {
+            listenSockets.push_back(adoptListenSocket(listenFd));
+        } else {
+            close(listenFd);
+        }
+    }
+
+    reactorCount = std::clamp(reactorCount, 1, MAX_REACTORS);
+    if (!listenSockets.empty()) {
+        int reusePort = 0;
+        socklen_t size = sizeof(reusePort);
+        getsockopt(listenSockets.front(), SOL_SOCKET, SO_REUSEPORT, &reusePort, &size);
+        if (!reusePort) {
+            // Nothing else can bind the port next to it
+            reactorCount = static_cast<int>(listenSockets.size());
+        } else {
+            // A listen socket without reactor would keep receiving connections that nobody accepts
+            reactorCount = std::max(reactorCount, static_cast<int>(listenSockets.size()));
+        }
+    }
+
+    for (int i = 0; i < reactorCount; i++) {
+        auto reactor = std::make_unique<Reactor>();
+        reactor->index = i;
+        reactor->listenSocket = static_cast<size_t>(i) < listenSockets.size() ? listenSockets[i] : listenTcp(port);
+
+        reactor->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        reactor->wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (reactor->epollFd == -1 || reactor->wakeupFd == -1) {
+            std::cerr << "Epoll creation failed" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = reactor->listenSocket;
+        epoll_ctl(reactor->epollFd, EPOLL_CTL_ADD, reactor->listenSocket, &event);
+
+        event.data.fd = reactor->wakeupFd;
+        epoll_ctl(reactor->epollFd, EPOLL_CTL_ADD, reactor->wakeupFd, &event);
+
+        if (ioBackend == IO_BACKEND_URING) {
+            reactor->uring = IoUring::create();
+            if (!reactor->uring) {
+                std::cerr << "io_uring unavailable, falling back to epoll" << std::endl;
+                ioBackend = IO_BACKEND_EPOLL;
+            }
+        }
+
+        reactors.push_back(std::move(reactor));
+    }
+
+    auto handedUnixPath = handoff.values.find("unix-socket");
+    if (handedUnixSocket != -1 && handedUnixPath != handoff.values.end() && handedUnixPath->second == unixSocketPath) {
+        unixSocket = handedUnixSocket;
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = unixSocket;
+        epoll_ctl(reactors.front()->epollFd, EPOLL_CTL_ADD, unixSocket, &event);
+    } else {
+        if (handedUnixSocket != -1) {
+            close(handedUnixSocket);
+        }
+        if (!unixSocketPath.empty()) {
+            this->listenUnixSocket();
+        }
+    }
+
+    std::cout << "Server started on port " << port << " with " << reactorCount << " reactor(s)" << std::endl;
+
+    // Indexed by name id, the interned id of a participant is its Participant value
+    clients.resize(PARTICIPANTS.size());
+
+    clients[PARTICIPANT_TIRETTE] = ClientTCP("tirette");
+    // clients[PARTICIPANT_ARUCO] = ClientTCP("aruco");
+    clients[PARTICIPANT_IHM] = ClientTCP("ihm");
+    clients[PARTICIPANT_LIDAR] = ClientTCP("lidar");
+    clients[PARTICIPANT_ARDUINO] = ClientTCP("arduino");
+    clients[PARTICIPANT_SERVO_MOTEUR] = ClientTCP("servo_moteur");
+
+    this->setState(STATE_POSE, formatPose(robotPose));
+    this->setState(STATE_SPEED, std::to_string(speed));
+    this->setState(STATE_TEAM, std::to_string(team));
+    this->publishPinces();
+    this->publishPhase();
+    this->setState(STATE_SCORE, std::to_string(score));
+
+    if (handoffChannel != -1) {
+        this->restoreHandoff(handoff, handoffFds, nextFd);
+
+        // From now on the previous server is gone, without the ok it serves the clients again
+        if (!HandoffChannel::sendMessage(handoffChannel, "ok")) {
+            std::cerr << "Confirming the handoff failed" << std::endl;
+            for (int fd : handoffFds) {
+                close(fd);
+            }
+            exit(EXIT_FAILURE);
+        }
+        close(handoffChannel);
+        std::cout << "Took " << handoff.clients.size() << " client(s) over" << std::endl;
+    }
+
+    if (!handoffSocketPath.empty()) {
+        handoffSocket = HandoffChannel::listenOn(handoffSocketPath);
+        if (handoffSocket == -1) {
+            std::cerr << "Listening on handoff socket failed" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+int TCPServer::adoptListenSocket(int listenFd)
+{
+    int listening = 0;
+    socklen_t size = sizeof(listening);
+    if (getsockopt(listenFd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &size) == -1 || !listening) {
+        std::cerr << "Inherited fd " << listenFd << " is not a listening socket" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+    fcntl(listenFd, F_SETFD, FD_CLOEXEC);
+    return listenFd;
+}
+
+void TCPServer::takeOver(int channel, HandoffState& state, std::vector<int>& fds)
+{
+    std::string data;
+    if (!HandoffChannel::receive(channel, fds, data) || !state.parse(data) || fds.size() != state.fdCount()) {
+        std::cerr << "Handoff from the running server failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+void TCPServer::restoreHandoff(const HandoffState& state, const std::vector<int>& fds, size_t firstClientFd)
+{
+    auto value = [&state](std::string_view key) -> std::string_view {
+        auto it = state.values.find(key);
+        return it == state.values.end() ? std::string_view() : std::string_view(it->second);
+    };
+
+    std::array<float, 3> pose{};
+    if (TCPUtils::parseArgs(value("pos"), pose)) {
+        this->robotPose = {pose[0], pose[1], pose[2]};
+    }
+    TCPUtils::parseNumber(value("speed"), this->speed);
+    int team;
+    if (TCPUtils::parseNumber(value("team"), team)) {
+        this->team = static_cast<Team>(team);
+    }
+    std::array<int, 3> pinces{};
+    if (TCPUtils::parseArgs(value("pince"), pinces)) {
+        for (size_t i = 0; i < pinces.size(); i++) {
+            pinceState[i] = static_cast<PinceState>(pinces[i]);
+        }
+    }
+    TCPUtils::parseNumber(value("score"), this->score);
+    this->arduinoPoseStreaming = value("pose-streaming") == "1";
+    if (!value("last-arduino-command").empty()) {
+        this->lastArduinoCommand = Frame::fromMessage(value("last-arduino-command"));
+    }
+    this->allClientsReady = value("all-ready") == "1";
+    // Same versions as before, the watchers handed off keep comparing with what they already got
+    for (int key = 0; key < STATE_KEY_COUNT; key++) {
+        std::string_view stored = value("state " + std::string(STATE_KEYS[key]));
+        size_t comma = stored.find(',');
+        StateValue restored;
+        if (comma != std::string_view::npos && TCPUtils::parseNumber(stored.substr(0, comma), restored.version)) {
+            restored.value = stored.substr(comma + 1);
+            store.restore(static_cast<StateKey>(key), std::move(restored));
+        }
+    }
+    std::string_view sessions = value("sessions");
+    std::string_view session;
+    while (TCPUtils::nextToken(sessions, ',', session)) {
+        size_t id;
+        if (TCPUtils::parseNumber(session, id) && id < clients.size()) {
+            clients[id].seen = true;
+        }
+    }
+
+    // Spread over the reactors, each one owns its share from now on
+    for (size_t i = 0; i < state.clients.size(); i++) {
+        const HandoffClient& client = state.clients[i];
+        int clientSocket = fds[firstClientFd + i];
+        Reactor& reactor = *reactors[i % reactors.size()];
+
+        if (!reactor.uring) {
+            epoll_event event{};
+            event.events = EPOLLIN | EPOLLRDHUP;
+            event.data.fd = clientSocket;
+            epoll_ctl(reactor.epollFd, EPOLL_CTL_ADD, clientSocket, &event);
+        }
+        ClientHandler& handler = this->addClient(reactor, clientSocket);
+
+        if (!client.name.empty()) {
+            this->participantReady(this->addRoute(client.name, clientSocket, client.features), clientSocket);
+        }
+        if (client.poseSubscriber) {
+            this->addPoseSubscriber(clientSocket);
+        }
+        if (client.watchedKeys) {
+            this->watchKeys(clientSocket, client.watchedKeys, true);
+        }
+        if (!client.topics.empty()) {
+            registry.update([clientSocket, &client](RegistrySnapshot& snapshot) {
+                if (snapshot.find(clientSocket)) {
+                    snapshot.bySocket[clientSocket].topics = client.topics;
+                    snapshot.compileTopics();
+                }
+            });
+        }
+        if (!client.output.empty()) {
+            this->enqueue(clientSocket, Frame::fromBytes(client.output));
+        }
+        // Only a partial line, nothing is handled before the rest arrives
+        handler.handleReceived(client.input);
+    }
+
+    // The polling thread of the previous server did not come along, checkIfAllClientsReady will not start it again
+    if (this->allClientsReady && !this->arduinoPoseStreaming) {
+        std::thread([this]() { askArduinoPos(); }).detach();
+    }
+}
+
+void TCPServer::runHandoffListener()
+{
+    while (!_shouldStop) {
+        int channel = accept4(handoffSocket, nullptr, nullptr, SOCK_CLOEXEC);
+        if (channel == -1) {
+            if (errno == EINTR) continue;
+            // stop() shuts the socket down
+            return;
+        }
+
+        HandoffChannel::setTimeouts(channel);
+        {
+            std::lock_guard lock(handoffMutex);
+            handoffPeer = channel;
+        }
+        bool done = this->handOff(channel);
+        {
+            std::lock_guard lock(handoffMutex);
+            handoffPeer = -1;
+        }
+        close(channel);
+        if (done) {
+            handedOff = true;
+            _shouldStop = true;
+            return;
+        }
+    }
+}
+
+bool TCPServer::handOff(int channel)
+{
+    if (gameStarted) {
+        std::cerr << "Handoff refused, the match is running" << std::endl;
+        HandoffChannel::sendMessage(channel, "refused;match running");
+        return false;
+    }
+
+    std::cout << "Handing off to the next server" << std::endl;
+    this->pauseReactors();
+
+    HandoffState state;
+    std::vector<int> fds;
+    this->captureHandoff(state, fds);
+
+    if (!HandoffChannel::send(channel, fds, state.serialize())) {
+        std::cerr << "Handoff failed, serving again" << std::endl;
+        handoffRequested = false;
+        this->startReactors();
+        return false;
+    }
+
+    // The next server may already serve the sockets, resuming before it gives up would serve them twice
+    std::string confirmation;
+    bool confirmed = HandoffChannel::receiveConfirmation(channel, confirmation) && confirmation == "ok";
+    if (confirmed || _shouldStop) {
+        // Interrupted by stop(), the sockets are left to the next server in case it took them
+        std::cout << "Handed " << state.clients.size() << " client(s) off" << std::endl;
+        return true;
+    }
+
+    std::cerr << "Handoff not confirmed, serving again" << std::endl;
+    handoffRequested = false;
+    this->startReactors();
+    return false;
+}
+
+void TCPServer::pauseReactors()
+{
+    handoffRequested = true;
+    for (auto& reactor : reactors) {
+        if (reactor->thread.joinable()) {
+            wakeupReactor(*reactor);
+            reactor->thread.join();
+        }
+    }
+}
+
+void TCPServer::captureHandoff(HandoffState& state, std::vector<int>& fds)
+{
+    // The reactors are stopped, only a strategy thread could still change the robot state
+    std::lock_guard lock(dispatchMutex);
+
+    for (const auto& reactor : reactors) {
+        fds.push_back(reactor->listenSocket);
+    }
+    state.listenSockets = reactors.size();
+    if (unixSocket != -1) {
+        fds.push_back(unixSocket);
+        state.unixSocket = true;
+        state.values["unix-socket"] = unixSocketPath;
+    }
+
+    state.values["pos"] = std::to_string(robotPose.pos.x) + "," + std::to_string(robotPose.pos.y) + "," + std::to_string(robotPose.theta);
+    state.values["speed"] = std::to_string(speed);
+    state.values["team"] = std::to_string(team);
+    state.values["pince"] = std::to_string(pinceState[0]) + "," + std::to_string(pinceState[1]) + "," + std::to_string(pinceState[2]);
+    state.values["pose-streaming"] = arduinoPoseStreaming ? "1" : "0";
+    if (FramePtr command = std::atomic_load(&lastArduinoCommand)) {
+        state.values["last-arduino-command"] = command->text;
+    }
+    state.values["score"] = std::to_string(score);
+    for (int key = 0; key < STATE_KEY_COUNT; key++) {
+        StateValue stored = store.get(static_cast<StateKey>(key));
+        if (stored.version != 0) {
+            state.values["state " + std::string(STATE_KEYS[key])] = std::to_string(stored.version) + "," + stored.value;
+        }
+    }
+    state.values["all-ready"] = allClientsReady ? "1" : "0";
+    std::string sessions;
+    for (size_t id = 0; id < clients.size(); id++) {
+        if (clients[id].seen) {
+            sessions += std::to_string(id) + ",";
+        }
+    }
+    state.values["sessions"] = sessions;
+
+    SnapshotPtr snapshot = registry.snapshot();
+    for (const auto& reactor : reactors) {
+        for (const auto& [clientSocket, handler] : reactor->clientHandlers) {
+            const ClientEntry* entry = snapshot->find(clientSocket);
+            // Shared memory clients reconnect, a send still in flight would interleave with the next server
+            if (!entry || handler.shm || handler.sending) {
+                std::cerr << "Client " << clientSocket << " is not handed off" << std::endl;
+                continue;
+            }
+
+            HandoffClient client;
+            if (entry->nameId != -1) {
+                client.name = snapshot->names[entry->nameId];
+            }
+            client.features = entry->features;
+            client.poseSubscriber = entry->poseSubscriber;
+            client.watchedKeys = entry->watchedKeys;
+            client.topics = entry->topics;
+            client.input = handler.pendingInput();
+            client.output = entry->queue->unsent();
+
+            fds.push_back(clientSocket);
+            state.clients.push_back(std::move(client));
+        }
+    }
+}
+
+void TCPServer::pauseUringReactor(Reactor& reactor)
+{
+    IoUring& uring = *reactor.uring;
+    uint64_t cancelled = IoUring::userData(URING_CANCEL, 0, 0);
+
+    // Nothing may read the sockets once they belong to the next server
+    uring.cancel(IoUring::userData(URING_ACCEPT, 0, reactor.listenSocket), cancelled);
+    if (unixSocket != -1 && reactor.index == 0) {
+        uring.cancel(IoUring::userData(URING_ACCEPT, 0, unixSocket), cancelled);
+    }
+    uring.cancel(IoUring::userData(URING_WAKEUP, 0, reactor.wakeupFd), cancelled);
+    for (const auto& [clientSocket, handler] : reactor.clientHandlers) {
+        uring.cancel(IoUring::userData(URING_RECV, handler.generation, clientSocket), cancelled);
+        if (handler.shm) {
+            uring.cancel(IoUring::userData(URING_SHARED_MEMORY, handler.generation, clientSocket), cancelled);
+        }
+    }
+
+    // A client that stopped reading would hold the handoff forever, its send is abandoned after the timeout
+    __kernel_timespec delay{};
+    delay.tv_sec = HANDOFF_DRAIN_TIMEOUT_MS / 1000;
+    delay.tv_nsec = HANDOFF_DRAIN_TIMEOUT_MS % 1000 * 1000000LL;
+    uint64_t timeout = IoUring::userData(URING_TIMEOUT, 0, 0);
+    uring.timeout(delay, timeout);
+
+    bool timedOut = false;
+    while (!timedOut && (reactor.armedOperations > 0 || !reactor.sendChains.empty())) {
+        if (!uring.submitAndWait(1)) {
+            break;
+        }
+        uring.drain([this, &reactor, &timedOut](const io_uring_cqe& cqe) {
+            if (IoUring::operationOf(cqe.user_data) == URING_TIMEOUT) {
+                timedOut = true;
+            } else {
+                this->handleCompletion(reactor, cqe);
+            }
+        });
+    }
+
+    if (!timedOut) {
+        uring.cancel(timeout, cancelled);
+    }
+    uring.submitAndWait(0);
+}
+
+int TCPServer::listenTcp(int port)
+{
+    int serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (serverSocket == -1) {
         std::cerr << "Socket creation failed" << std::endl;
         exit(EXIT_FAILURE);
@@ -60,6 +557,11 @@ TCPServer::TCPServer(int port) : team(TEST)
     address.sin_addr.s_addr = INADDR_ANY;
     address.sin_port = htons(port);
 
+    // The kernel spreads the incoming connections between the sockets bound to the same port
+    int reuse = 1;
+    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+
     if (bind(serverSocket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1) {
         std::cerr << "Binding failed" << std::endl;
         exit(EXIT_FAILURE);
@@ -70,318 +572,1101 @@ TCPServer::TCPServer(int port) : team(TEST)
         exit(EXIT_FAILURE);
     }
 
-    std::cout << "Server started on port " << port << std::endl;
+    return serverSocket;
+}
 
-    clients.reserve(5);
+void TCPServer::listenUnixSocket()
+{
+    sockaddr_un address{};
+    if (unixSocketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Unix socket path too long : " << unixSocketPath << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
-    clients.emplace_back("tirette");
-    // clients.emplace_back("aruco");
-    clients.emplace_back("ihm");
-    clients.emplace_back("lidar");
-    clients.emplace_back("arduino");
-    clients.emplace_back("servo_moteur");
-    // clients.emplace_back("point");
+    unixSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (unixSocket == -1) {
+        std::cerr << "Unix socket creation failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
 
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, unixSocketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    // A previous run that did not stop cleanly leaves its socket file behind
+    unlink(unixSocketPath.c_str());
+
+    if (bind(unixSocket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1) {
+        std::cerr << "Binding unix socket failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    if (listen(unixSocket, 5) == -1) {
+        std::cerr << "Listening on unix socket failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = unixSocket;
+    epoll_ctl(reactors.front()->epollFd, EPOLL_CTL_ADD, unixSocket, &event);
+
+    std::cout << "Server listening on " << unixSocketPath << std::endl;
 }
 
-void TCPServer::acceptConnections()
+void TCPServer::acceptConnections(Reactor& reactor, int listenSocket)
 {
     while (!_shouldStop) {
-        sockaddr_in clientAddress{};
-        int addrlen = sizeof(clientAddress);
+        sockaddr_storage clientAddress{};
+        socklen_t addrlen = sizeof(clientAddress);
         int clientSocket =
-            accept(serverSocket, reinterpret_cast<struct sockaddr*>(&clientAddress), reinterpret_cast<socklen_t*>(&addrlen));
+            accept4(listenSocket, reinterpret_cast<struct sockaddr*>(&clientAddress), &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (clientSocket == -1) {
-            std::cerr << "Accepting connection failed" << std::endl;
-            continue;
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                std::cerr << "Accepting connection failed" << std::endl;
+            }
+            return;
         }
         std::cout << "Connection accepted" << std::endl;
 
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = clientSocket;
+        if (epoll_ctl(reactor.epollFd, EPOLL_CTL_ADD, clientSocket, &event) == -1) {
+            std::cerr << "Registering client socket failed" << std::endl;
+            close(clientSocket);
+            continue;
+        }
 
-        // Add the client socket to the list
-        clientSockets.push_back(clientSocket);
-        connectedClients++;
-
-        // Handle client connection in a separate thread
-        clientThreads.emplace_back(&ClientHandler::handle, ClientHandler(clientSocket, this));
-        // Clean up finished threads
-        clientThreads.erase(std::remove_if(clientThreads.begin(), clientThreads.end(), [](std::thread &t) {
-            return !t.joinable();
-        }), clientThreads.end());
+        this->addClient(reactor, clientSocket);
     }
 }
 
-void TCPServer::handleMessage(const std::string& message, int clientSocket)
+ClientHandler& TCPServer::addClient(Reactor& reactor, int clientSocket)
 {
-    std::cout << message << std::endl;
+    uint32_t generation = reactor.nextGeneration++;
 
-    std::vector<std::string> tokens = TCPUtils::split(message, ";");
+    // Add the client socket to the registry
+    registry.update([&reactor, clientSocket, generation](RegistrySnapshot& snapshot) {
+        ClientEntry& client = snapshot.add(clientSocket);
+        client.queue = std::make_shared<OutboundQueue>();
+        client.reactor = &reactor;
+        client.generation = generation;
+    });
+    connectedClients++;
 
-    if (tokens.size() != 4)
-    {
-        std::cerr << "Invalid message format, token size : " << std::to_string(tokens.size()) << " from message : " << message << std::endl;
+    ClientHandler& handler = reactor.clientHandlers.emplace(clientSocket, ClientHandler(clientSocket, this)).first->second;
+    handler.generation = generation;
+    return handler;
+}
+
+void TCPServer::runReactor(Reactor& reactor)
+{
+    epoll_event events[MAX_EPOLL_EVENTS];
+    reactorArena = &reactor.arena;
+
+    while (!_shouldStop && !handoffRequested) {
+        int nbEvents = epoll_wait(reactor.epollFd, events, MAX_EPOLL_EVENTS, -1);
+        if (nbEvents == -1) {
+            if (errno == EINTR) continue;
+            std::cerr << "Epoll wait failed" << std::endl;
+            break;
+        }
+
+        for (int i = 0; i < nbEvents; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == reactor.listenSocket || fd == unixSocket) {
+                acceptConnections(reactor, fd);
+            } else if (fd == reactor.wakeupFd) {
+                eventfd_t value;
+                eventfd_read(reactor.wakeupFd, &value);
+            } else if (auto shm = reactor.sharedMemoryEvents.find(fd); shm != reactor.sharedMemoryEvents.end()) {
+                int clientSocket = shm->second;
+                auto it = reactor.clientHandlers.find(clientSocket);
+                if (it != reactor.clientHandlers.end() && !it->second.handleSharedMemory()) {
+                    this->removeHandler(reactor, it);
+                    continue;
+                }
+                // The client may have freed space in the outbound ring
+                this->flushClient(reactor, clientSocket);
+            } else {
+                if (events[i].events & EPOLLOUT) {
+                    this->flushClient(reactor, fd);
+                }
+
+                auto it = reactor.clientHandlers.find(fd);
+                if (it != reactor.clientHandlers.end() && (events[i].events & ~EPOLLOUT) && !it->second.handle()) {
+                    this->removeHandler(reactor, it);
+                }
+            }
+        }
+
+        this->flushDirtyClients(reactor);
+        reactor.arena.release();
+    }
+
+    // Give the last messages a chance to leave before closing, or before handing the queues off
+    this->flushDirtyClients(reactor);
+    if (!_shouldStop) {
         return;
     }
-    if (TCPUtils::contains(tokens[2], "stop proximity")) {
-        if (!gameStarted) return;
 
-        std::vector<std::string> args = TCPUtils::split(tokens[3], ",");
+    while (!reactor.clientHandlers.empty()) {
+        reactor.clientHandlers.begin()->second.closeConnection();
+        this->removeHandler(reactor, reactor.clientHandlers.begin());
+    }
+}
+
+void TCPServer::runUringReactor(Reactor& reactor)
+{
+    IoUring& uring = *reactor.uring;
+    reactorArena = &reactor.arena;
+
+    uring.acceptMultishot(reactor.listenSocket, IoUring::userData(URING_ACCEPT, 0, reactor.listenSocket));
+    reactor.armedOperations++;
+    if (unixSocket != -1 && reactor.index == 0) {
+        uring.acceptMultishot(unixSocket, IoUring::userData(URING_ACCEPT, 0, unixSocket));
+        reactor.armedOperations++;
+    }
+    uring.pollMultishot(reactor.wakeupFd, IoUring::userData(URING_WAKEUP, 0, reactor.wakeupFd));
+    reactor.armedOperations++;
 
-        if (stoi(args[0]) == -1) return;
+    // Clients taken over from the previous server, or kept by a handoff that failed
+    for (const auto& [clientSocket, handler] : reactor.clientHandlers) {
+        uring.reserve(2);
+        uring.recvMultishot(clientSocket, IoUring::userData(URING_RECV, handler.generation, clientSocket));
+        reactor.armedOperations++;
+        if (handler.shm) {
+            uring.pollMultishot(handler.shm->serverEvent(), IoUring::userData(URING_SHARED_MEMORY, handler.generation, clientSocket));
+            reactor.armedOperations++;
+        }
+    }
 
-        this->broadcastMessage("strat;arduino;clear;1\n");
+    while (!_shouldStop && !handoffRequested) {
+        if (!uring.submitAndWait(1)) {
+            break;
+        }
 
-        this->stopEmergency = true;
+        uring.drain([this, &reactor](const io_uring_cqe& cqe) { this->handleCompletion(reactor, cqe); });
 
-        // if (!handleEmergencyFlag) {
-            // std::thread([this, args]() { this->handleEmergency(std::stoi(args[0]), std::stod(args[1]) / 100); }).detach();
-        // }
+        this->flushDirtyClients(reactor);
+        reactor.arena.release();
     }
-    else if (tokens[1] != "strat") {
-        this->broadcastMessage(message, clientSocket);
+
+    if (!_shouldStop) {
+        this->pauseUringReactor(reactor);
+        return;
     }
-    // EMERGENCY
-    else if (tokens[0] == "tirette" && tokens[2] == "set state") {
-        this->broadcastMessage(message, clientSocket);
+
+    // Give the last messages a chance to leave before closing, the sends keep their socket open
+    this->flushDirtyClients(reactor);
+    uring.submitAndWait(0);
+
+    while (!reactor.clientHandlers.empty()) {
+        reactor.clientHandlers.begin()->second.closeConnection();
+        this->removeHandler(reactor, reactor.clientHandlers.begin());
     }
-    else if (tokens[2] == "ready") {
-        for (ClientTCP& client : clients)
-        {
-            if (client.name == tokens[0])
-            {
-                client.isReady = true;
-                client.socket = clientSocket;
-                if (TCPUtils::contains(client.name, "lidar")) {
-                    this->lidarSocket = clientSocket;
+    uring.submitAndWait(0);
+}
+
+void TCPServer::handleCompletion(Reactor& reactor, const io_uring_cqe& cqe)
+{
+    IoUring& uring = *reactor.uring;
+    uint32_t id = IoUring::idOf(cqe.user_data);
+    uint32_t generation = IoUring::generationOf(cqe.user_data);
+    // A multishot operation without this flag is over and has to be armed again
+    bool armed = cqe.flags & IORING_CQE_F_MORE;
+    uint8_t operation = IoUring::operationOf(cqe.user_data);
+    if (!armed && (operation == URING_ACCEPT || operation == URING_RECV || operation == URING_WAKEUP || operation == URING_SHARED_MEMORY)) {
+        reactor.armedOperations--;
+    }
+    // Once paused for a handoff nothing is armed again
+    bool rearm = !armed && !_shouldStop && !handoffRequested;
+
+    switch (operation) {
+        case URING_ACCEPT: {
+            int listenSocket = static_cast<int>(id);
+            if (cqe.res >= 0) {
+                std::cout << "Connection accepted" << std::endl;
+                ClientHandler& handler = this->addClient(reactor, cqe.res);
+                // Accepted while pausing, the next server arms it
+                if (!handoffRequested) {
+                    uring.recvMultishot(cqe.res, IoUring::userData(URING_RECV, handler.generation, cqe.res));
+                    reactor.armedOperations++;
                 }
-                std::cout << client.socket << " | " << client.name << " is ready" << std::endl;
+            } else if (cqe.res == -EINVAL || cqe.res == -EOPNOTSUPP) {
+                // Arming it again would only fail again, right away
+                std::cerr << "Multishot accept unsupported, reactor stops accepting" << std::endl;
+                rearm = false;
+            } else if (cqe.res != -ECANCELED) {
+                std::cerr << "Accepting connection failed" << std::endl;
+            }
+            if (rearm) {
+                uring.acceptMultishot(listenSocket, cqe.user_data);
+                reactor.armedOperations++;
+            }
+            break;
+        }
+        case URING_RECV: {
+            int clientSocket = static_cast<int>(id);
+            auto it = reactor.clientHandlers.find(clientSocket);
+            bool current = it != reactor.clientHandlers.end() && it->second.generation == generation;
+
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                bool alive = !current || it->second.handleReceived(uring.buffer(cqe));
+                uring.recycleBuffer(cqe);
+                if (!alive) {
+                    this->removeHandler(reactor, it);
+                    break;
+                }
+            }
+
+            if (!current) {
                 break;
             }
+
+            if (cqe.res == 0) {
+                std::cout << "Client disconnected. " << clientSocket << std::endl;
+                it->second.closeConnection();
+                this->removeHandler(reactor, it);
+            } else if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+                // Cancelled by a handoff, the connection lives on in the next server
+                std::cerr << "Failed to receive data." << clientSocket << std::endl;
+                it->second.closeConnection();
+                this->removeHandler(reactor, it);
+            } else if (rearm) {
+                // Out of provided buffers, they are back in the ring by now
+                uring.recvMultishot(clientSocket, cqe.user_data);
+                reactor.armedOperations++;
+            }
+            break;
+        }
+        case URING_SEND:
+            this->onSendCompleted(reactor, id, cqe.res);
+            break;
+        case URING_WAKEUP: {
+            eventfd_t value;
+            eventfd_read(reactor.wakeupFd, &value);
+            if (rearm) {
+                uring.pollMultishot(reactor.wakeupFd, cqe.user_data);
+                reactor.armedOperations++;
+            }
+            break;
+        }
+        case URING_SHARED_MEMORY: {
+            int clientSocket = static_cast<int>(id);
+            auto it = reactor.clientHandlers.find(clientSocket);
+            if (it == reactor.clientHandlers.end() || it->second.generation != generation || !it->second.shm) {
+                break;
+            }
+            if (!it->second.handleSharedMemory()) {
+                this->removeHandler(reactor, it);
+                break;
+            }
+            if (rearm) {
+                uring.pollMultishot(it->second.shm->serverEvent(), cqe.user_data);
+                reactor.armedOperations++;
+            }
+            // The client may have freed space in the outbound ring
+            this->flushClient(reactor, clientSocket);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void TCPServer::submitSends(Reactor& reactor, int clientSocket, ClientHandler& handler, OutboundQueue& queue)
+{
+    IoUring& uring = *reactor.uring;
+    SendChain chain;
+    chain.clientSocket = clientSocket;
+    chain.generation = handler.generation;
+    if (queue.take(chain.frames, chain.bytes, OUTBOUND_QUEUE_MAX_IOV) == 0) {
+        return;
+    }
+
+    // Linked so that the frames leave in order, the whole chain goes in one submission
+    uint32_t chainId = reactor.nextSendChain++;
+    uring.reserve(chain.bytes.size());
+    for (size_t i = 0; i < chain.bytes.size(); i++) {
+        uring.send(clientSocket, chain.bytes[i], IoUring::userData(URING_SEND, 0, chainId), i + 1 < chain.bytes.size());
+    }
+
+    reactor.sendChains.emplace(chainId, std::move(chain));
+    handler.sending = true;
+}
+
+void TCPServer::onSendCompleted(Reactor& reactor, const uint32_t chainId, const int result)
+{
+    auto it = reactor.sendChains.find(chainId);
+    if (it == reactor.sendChains.end()) {
+        return;
+    }
+
+    SendChain& chain = it->second;
+    // The sends after a failed one of the chain complete with -ECANCELED
+    if (result < 0 || static_cast<size_t>(result) < chain.bytes[chain.completed].size()) {
+        chain.failed = true;
+    }
+    if (++chain.completed < chain.bytes.size()) {
+        return;
+    }
+
+    int clientSocket = chain.clientSocket;
+    uint32_t generation = chain.generation;
+    bool failed = chain.failed;
+    reactor.sendChains.erase(it);
+
+    auto handler = reactor.clientHandlers.find(clientSocket);
+    if (handler == reactor.clientHandlers.end() || handler->second.generation != generation) {
+        return;
+    }
+
+    handler->second.sending = false;
+    if (failed) {
+        std::cerr << "Failed to send data." << clientSocket << std::endl;
+        handler->second.closeConnection();
+        this->removeHandler(reactor, handler);
+        return;
+    }
+
+    // Frames queued while the chain was in flight
+    this->flushClient(reactor, clientSocket);
+}
+
+void TCPServer::removeHandler(Reactor& reactor, std::unordered_map<int, ClientHandler>::iterator handler)
+{
+    if (reactor.uring) {
+        IoUring& uring = *reactor.uring;
+        // The armed operations hold a reference on the socket, it is only released once they are cancelled
+        int clientSocket = handler->first;
+        uint32_t generation = handler->second.generation;
+        uring.cancel(IoUring::userData(URING_RECV, generation, clientSocket), IoUring::userData(URING_CANCEL, 0, 0));
+        if (handler->second.shm) {
+            uring.cancel(IoUring::userData(URING_SHARED_MEMORY, generation, clientSocket), IoUring::userData(URING_CANCEL, 0, 0));
+        }
+        reactor.clientHandlers.erase(handler);
+        return;
+    }
+
+    // The client still holds the eventfd, closing ours would not remove it from epoll
+    if (handler->second.shm) {
+        epoll_ctl(reactor.epollFd, EPOLL_CTL_DEL, handler->second.shm->serverEvent(), nullptr);
+        reactor.sharedMemoryEvents.erase(handler->second.shm->serverEvent());
+    }
+    reactor.clientHandlers.erase(handler);
+}
+
+void TCPServer::setupSharedMemory(int clientSocket, const std::string_view name, const std::string_view args)
+{
+    std::string refused = "strat;" + std::string(name) + ";shm;0\n";
+
+    // Called by the reactor of the client while it handles the request
+    SnapshotPtr snapshot = registry.snapshot();
+    const ClientEntry* client = snapshot->find(clientSocket);
+    if (!client) {
+        return;
+    }
+    Reactor* reactor = client->reactor;
+    const std::shared_ptr<OutboundQueue>& queue = client->queue;
+
+    auto handler = reactor->clientHandlers.find(clientSocket);
+    sockaddr_storage address{};
+    socklen_t addrlen = sizeof(address);
+    size_t capacity;
+    if (handler == reactor->clientHandlers.end() || handler->second.shm || !TCPUtils::parseNumber(args, capacity) ||
+        getsockname(clientSocket, reinterpret_cast<struct sockaddr*>(&address), &addrlen) == -1 || address.ss_family != AF_UNIX) {
+        this->sendToClient(refused, clientSocket);
+        return;
+    }
+
+    // The handshake goes around the queue, it must not overtake frames still waiting in it
+    if (handler->second.sending || queue->flush(clientSocket) != OutboundQueue::FLUSHED) {
+        this->sendToClient(refused, clientSocket);
+        return;
+    }
+
+    std::unique_ptr<ShmTransport> transport = ShmTransport::create(capacity);
+    if (!transport || !transport->sendHandshake(clientSocket, "strat;" + std::string(name) + ";shm;" + std::to_string(transport->capacity()) + "\n")) {
+        this->sendToClient(refused, clientSocket);
+        return;
+    }
+
+    if (reactor->uring) {
+        reactor->uring->pollMultishot(transport->serverEvent(), IoUring::userData(URING_SHARED_MEMORY, handler->second.generation, clientSocket));
+        reactor->armedOperations++;
+    } else {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = transport->serverEvent();
+        epoll_ctl(reactor->epollFd, EPOLL_CTL_ADD, transport->serverEvent(), &event);
+        reactor->sharedMemoryEvents[transport->serverEvent()] = clientSocket;
+    }
+
+    std::cout << name << " switched to shared memory rings of " << transport->capacity() << " bytes" << std::endl;
+    queue->limitFrameSize(transport->capacity());
+    handler->second.shm = std::move(transport);
+}
+
+void TCPServer::wakeupReactor(const Reactor& reactor)
+{
+    eventfd_write(reactor.wakeupFd, 1);
+}
+
+void TCPServer::dispatchMessage(const std::string_view message, int clientSocket)
+{
+    std::lock_guard lock(dispatchMutex);
+    if (message.front() == BINARY_MAGIC) {
+        this->handleBinaryMessage(message, clientSocket);
+        return;
+    }
+    this->handleMessage(message, clientSocket);
+}
+
+void TCPServer::handleMessage(const std::string_view message, int clientSocket)
+{
+    std::cout << message << std::endl;
+
+    // sender;receiver;verb;args[;correlation id]
+    std::array<std::string_view, 5> tokens;
+    size_t nbTokens = TCPUtils::splitView(message, ';', tokens);
+
+    if (nbTokens != 4 && nbTokens != 5)
+    {
+        std::cerr << "Invalid message format, token size : " << std::to_string(nbTokens) << " from message : " << message << std::endl;
+        return;
+    }
+
+    if (tokens[1] == "strat") {
+        std::optional<int> requestId;
+        int id;
+        if (nbTokens == 5 && TCPUtils::parseNumber(tokens[4], id)) {
+            requestId = id;
+        }
+        this->requestTracker.complete(tokens[0], tokens[2], tokens[3], requestId);
+
+        // Only the server gets it otherwise, the other messages are published when they are routed
+        SnapshotPtr snapshot = registry.snapshot();
+        if (snapshot->topics) {
+            this->publishTopic(*snapshot, message, nullptr, clientSocket, {});
+        }
+    }
+    // Any receiver, the lidar and the arduino word it in several ways
+    if (TCPUtils::contains(tokens[2], "stop proximity")) {
+        this->handleStopProximity(tokens[3]);
+    }
+    else if (tokens[1] != "strat") {
+        this->routeMessage(message, clientSocket);
+    }
+    else if (const CommandHandler* handler = this->findCommand(tokens[0], tokens[2])) {
+        (*handler)(Command{message, tokens[0], tokens[2], tokens[3], clientSocket});
+    }
+}
+
+void TCPServer::registerCommands() {
+    commandHandlers.assign(COMMAND_VERBS.size() * COMMAND_SENDERS, nullptr);
+
+    // EMERGENCY
+    this->onCommand("tirette", "set state", [this](const Command& command) {
+        this->broadcastMessage(command.message, command.clientSocket);
+    });
+    this->onCommand("*", "ready", [this](const Command& command) {
+        if (this->participantReady(this->addRoute(command.sender, command.clientSocket, parseFeatures(command.args)), command.clientSocket)) {
+            this->sendSnapshot(command.sender, command.clientSocket);
         }
         checkIfAllClientsReady();
+    });
+    this->onCommand("*", "get pos", [this](const Command& command) {
+        this->setPosition(this->robotPose, command.clientSocket);
+    });
+    this->onCommand("*", "get value", [this](const Command& command) {
+        this->sendValue(command.sender, command.args, command.clientSocket);
+    });
+    this->onCommand("*", "watch values", [this](const Command& command) {
+        this->watchValues(command.sender, command.args, command.clientSocket);
+    });
+    this->onCommand("*", "unwatch values", [this](const Command& command) {
+        this->watchKeys(command.clientSocket, parseKeys(command.args), false);
+    });
+    this->onCommand("*", "subscribe", [this](const Command& command) {
+        this->subscribeTopics(command.args, command.clientSocket);
+    });
+    this->onCommand("*", "unsubscribe", [this](const Command& command) {
+        this->unsubscribeTopics(command.args, command.clientSocket);
+    });
+    this->onCommand("*", "get speed", [this](const Command& command) {
+        this->sendMessage(command.sender, SetSpeedMessage{this->speed}, command.clientSocket);
+    });
+    this->onCommand("*", "shm", [this](const Command& command) {
+        this->setupSharedMemory(command.clientSocket, command.sender, command.args);
+    });
+    this->onCommand("*", "subscribe pos", [this](const Command& command) {
+        this->addPoseSubscriber(command.clientSocket);
+        this->setPosition(this->robotPose.pos.x, this->robotPose.pos.y, this->robotPose.theta, command.clientSocket);
+    });
+    this->onCommand("*", "unsubscribe pos", [this](const Command& command) {
+        this->removePoseSubscriber(command.clientSocket);
+    });
+    this->onCommand("ihm", "spawn", [this](const Command& command) {
+        this->handleSpawn(command.args);
+    });
+    this->onCommand("ihm", "start", [this](const Command& command) {
+        this->startMatch(command.message, command.clientSocket);
+    });
+    this->onCommand("aruco", "get aruco", [this](const Command& command) {
+        this->handleArucoResponse(command.message, command.args, command.clientSocket);
+    });
+    this->onCommand("arduino", "set state", [this](const Command& command) {
+        this->onArduinoState(TCPUtils::startWith(command.args, "0"));
+    });
+    this->onCommand("arduino", "set speed", [this](const Command& command) {
+        if (!TCPUtils::parseNumber(command.args, this->speed)) {
+            std::cerr << "Invalid speed : " << command.args << std::endl;
+        }
+        this->setState(STATE_SPEED, std::to_string(speed));
+    });
+    this->onCommand("arduino", "set pos", [this](const Command& command) {
+        PoseMessage pose{};
+        if (!Messages::decode(command.args, pose)) {
+            std::cerr << "Invalid arduino position : " << command.args << std::endl;
+            return;
+        }
+        this->onArduinoPose(pose.x, pose.y, pose.theta / 100);
+    });
+    this->onCommand("arduino", "subscribed pos", [this](const Command&) {
+        std::cout << "Arduino streams its position" << std::endl;
+        this->arduinoPoseStreaming = true;
+    });
+    this->onCommand("*", "test aruco", [this](const Command& command) {
+        int pince;
+        if (!TCPUtils::parseNumber(command.args, pince)) {
+            std::cerr << "Invalid pince : " << command.args << std::endl;
+            return;
+        }
+
+        std::thread([this, pince]() { this->startTestAruco(pince); }).detach();
+    });
+}
+
+void TCPServer::onCommand(const std::string_view sender, const std::string_view verb, CommandHandler handler) {
+    int verbId = COMMAND_HASH.find(verb);
+    uint8_t senderId = sender == "*" ? COMMAND_ANY_SENDER : BinaryProtocol::participantId(sender);
+    if (verbId == -1 || senderId == PARTICIPANT_UNKNOWN) {
+        std::cerr << "Cannot handle " << verb << " from " << sender << ", add them to COMMAND_VERBS and PARTICIPANTS" << std::endl;
+        exit(EXIT_FAILURE);
     }
-    else if (tokens[2] == "get pos") {
-        this->setPosition(this->robotPose, clientSocket);
+    commandHandlers[verbId * COMMAND_SENDERS + senderId] = std::move(handler);
+}
+
+const CommandHandler* TCPServer::findCommand(const std::string_view sender, const std::string_view verb) const {
+    int verbId = COMMAND_HASH.find(verb);
+    if (verbId == -1) {
+        return nullptr;
     }
-    else if (tokens[2] == "get speed") {
-        this->sendToClient("strat;" + tokens[0] + ";set speed;" + std::to_string(this->speed) + "\n", clientSocket);
+
+    const CommandHandler* row = &commandHandlers[verbId * COMMAND_SENDERS];
+    uint8_t senderId = BinaryProtocol::participantId(sender);
+    if (senderId != PARTICIPANT_UNKNOWN && row[senderId]) {
+        return &row[senderId];
     }
-    else if (tokens[0] == "lidar" && tokens[2] == "set pos") {
-        std::vector<std::string> args = TCPUtils::split(tokens[3], ",");
-        // TODO replace angle with the real angle calculated by the lidar when working
-        this->lidarCalculatePos = {std::stof(args[0]), std::stof(args[1]), /*std::stof(args[2]) / 100*/ this->robotPose.theta};
-        if (lidarCalculatePos.pos.x == -1 || lidarCalculatePos.pos.y == -1) {
-            if (lidarGetPosTimeout > 10) {
-                awaitForLidar = false;
+    return row[COMMAND_ANY_SENDER] ? &row[COMMAND_ANY_SENDER] : nullptr;
+}
+
+void TCPServer::handleStopProximity(const std::string_view args) {
+    if (!gameStarted) return;
+
+    std::array<std::string_view, 2> values;
+    int distance;
+    if (TCPUtils::splitView(args, ',', values) == 0 || !TCPUtils::parseNumber(values[0], distance)) {
+        std::cerr << "Invalid stop proximity arguments : " << args << std::endl;
+        return;
+    }
+
+    if (distance == -1) return;
+
+    this->routeMessage("strat;arduino;clear;1\n");
+
+    this->stopEmergency = true;
+    this->motionCondition.notify_all();
+
+    // if (!handleEmergencyFlag) {
+        // std::thread([this, values]() { this->handleEmergency(std::stoi(values[0]), std::stod(values[1]) / 100); }).detach();
+    // }
+}
+
+void TCPServer::handleSpawn(const std::string_view args) {
+    int spawnPointNb;
+    if (!TCPUtils::parseNumber(args, spawnPointNb)) {
+        std::cerr << "Invalid spawn point : " << args << std::endl;
+        return;
+    }
+    std::array<float, 3> spawnPoint{};
+    std::array<float, 3> finishPoint{};
+
+    switch (spawnPointNb) {
+        case 3:
+            this->setTeam(BLUE);
+            spawnPoint[0] = 250;
+            spawnPoint[1] = 1800;
+            spawnPoint[2] = 0;
+
+            finishPoint[0] = 400;
+            finishPoint[1] = 500;
+            finishPoint[2] = PI / 2;
+
+            // For test
+
+            /*spawnPoint[0] = 500;
+            spawnPoint[1] = 1000;
+            spawnPoint[2] = 0;*/
+
+            /*finishPoint[0] = 400;
+            finishPoint[1] = 1790;
+            finishPoint[2] = 0;*/
+            break;
+        case 6:
+            this->setTeam(YELLOW);
+            spawnPoint[0] = 2750;
+            spawnPoint[1] = 1800;
+            spawnPoint[2] = PI;
+
+            finishPoint[0] = 2600;
+            finishPoint[1] = 500;
+            finishPoint[2] = PI / 2;
+            break;
+
+        default:
+            this->team = TEST;
+            this->setState(STATE_TEAM, std::to_string(team));
+            spawnPoint[0] = 1200;
+            spawnPoint[1] = 1800;
+            spawnPoint[2] = PI / 2;
+
+            finishPoint[0] = 1200;
+            finishPoint[1] = 1800;
+            finishPoint[2] = PI / 2;
+            break;
+    }
+
+    std::ofstream file("end_point.txt");
+    file << finishPoint[0] << " " << finishPoint[1];
+    file.close();
+
+    this->robotPose = {spawnPoint[0], spawnPoint[1], spawnPoint[2]};
+    this->setState(STATE_POSE, formatPose(robotPose));
+    this->initRobotPose = {spawnPoint[0], spawnPoint[1], spawnPoint[2]};
+    this->endRobotPose = {finishPoint[0], finishPoint[1], finishPoint[2]};
+
+    // Repeated until the devices settle, away from the reactor that runs this handler
+    std::thread([this, spawn = this->initRobotPose]() {
+        for (int j = 0; j < 3 && !this->_shouldStop; j++) {
+            this->setPosition(spawn);
+            usleep(100'000);
+        }
+    }).detach();
+}
+
+void TCPServer::startMatch(const std::string_view message, const int clientSocket) {
+    if (this->gameStarted) {
+        return;
+    }
+
+    this->broadcastMessage(message, clientSocket);
+
+    this->gameStarted = true;
+    this->publishPhase();
+
+    this->gameStart = std::chrono::system_clock::now();
+
+    this->setSpeed(200);
+
+    switch (this->team) {
+        case BLUE:
+        case YELLOW:
+            this->gameThread = std::thread([this]() { this->startGame(); });
+            break;
+        case TEST:
+            this->gameThread = std::thread([this]() { this->startGameTest(); });
+            break;
+    }
+
+    this->gameThread.detach();
+}
+
+void TCPServer::handleArucoResponse(const std::string_view message, const std::string_view args, const int clientSocket) {
+    std::string_view arucoResponse = args;
+    if (arucoResponse != "404") {
+        ArucoTagMessage received{};
+        while (!arucoResponse.empty()) {
+            if (!Messages::decodeNext(arucoResponse, received)) {
+                std::cerr << "Invalid aruco tag from message : " << message << std::endl;
+                break;
             }
-            lidarGetPosTimeout++;
-            this->askLidarPosition();
+
+            ArucoTag tag;
+            tag.setId(received.id);
+            tag.setName(std::string(received.name));
+
+            tag.setPos(received.x, received.y);
+            tag.setRot(received.rotX, received.rotY, received.rotZ);
+
+            // std::cout << tag << std::endl;
+
+            handleArucoTag(tag);
         }
-        else {
-            this->setPosition(this->lidarCalculatePos);
-            usleep(100'000);
-            this->setPosition(this->lidarCalculatePos);
-            awaitForLidar = false;
+        this->publishArucoTags();
+        // Broadcast the aruco tag to all clients
+        this->broadcastMessage(message, clientSocket);
+    }
+}
+
+void TCPServer::handleBinaryMessage(const std::string_view frame, int clientSocket)
+{
+    BinaryProtocol::Header header{};
+    if (!BinaryProtocol::decodeHeader(frame, header)) {
+        std::cerr << "Invalid binary frame of " << frame.size() << " bytes from " << clientSocket << std::endl;
+        return;
+    }
+
+    // Arduino telemetry is read straight from the payload
+    if (header.sender == PARTICIPANT_ARDUINO && header.receiver == PARTICIPANT_STRAT &&
+        (header.type == BINARY_POSE || header.type == BINARY_STATE || header.type == BINARY_SPEED)) {
+        // Subscribers get the same text as from a text arduino
+        SnapshotPtr snapshot = registry.snapshot();
+        std::pmr::string message(scratch());
+        if (snapshot->topics && BinaryProtocol::toText(frame, message)) {
+            this->publishTopic(*snapshot, message, nullptr, clientSocket, {});
+        }
+
+        switch (header.type) {
+            case BINARY_POSE:
+                this->onArduinoPose(BinaryProtocol::readInt16(header.payload, 0), BinaryProtocol::readInt16(header.payload, 1),
+                                    static_cast<float>(BinaryProtocol::readInt16(header.payload, 2)) / 100);
+                return;
+            case BINARY_STATE:
+                this->onArduinoState(BinaryProtocol::readInt16(header.payload, 0) == 0);
+                return;
+            case BINARY_SPEED:
+                this->speed = BinaryProtocol::readInt16(header.payload, 0);
+                this->setState(STATE_SPEED, std::to_string(speed));
+                return;
+            default:
+                break;
         }
     }
-    else if (tokens[0] == "ihm") {
-        if (tokens[2] == "spawn") {
-            int spawnPointNb = std::stoi(tokens[3]);
-            std::array<float, 3> spawnPoint{};
-            std::array<float, 3> finishPoint{};
 
-            switch (spawnPointNb) {
-                case 3:
-                    this->setTeam(BLUE);
-                    spawnPoint[0] = 250;
-                    spawnPoint[1] = 1800;
-                    spawnPoint[2] = 0;
+    std::pmr::string message(scratch());
+    if (!BinaryProtocol::toText(frame, message)) {
+        std::cerr << "Invalid binary frame of " << frame.size() << " bytes from " << clientSocket << std::endl;
+        return;
+    }
+    this->handleMessage(message, clientSocket);
+}
 
-                    finishPoint[0] = 400;
-                    finishPoint[1] = 500;
-                    finishPoint[2] = PI / 2;
+void TCPServer::onArduinoPose(const float x, const float y, const float theta) {
+    this->robotPose = {x, y, theta};
+    this->setState(STATE_POSE, formatPose(robotPose));
+    // The lidar must not be given a new reference while it computes its own position
+    if (!requestTracker.hasPending("lidar")) {
+        this->setPosition(this->robotPose, lidarSocket);
+    }
+    this->publishPose();
+}
 
-                    // For test
+void TCPServer::broadcastMessage(const char* message, int senderSocket)
+{
+    this->broadcastMessage(std::string_view(message), senderSocket);
+}
 
-                    /*spawnPoint[0] = 500;
-                    spawnPoint[1] = 1000;
-                    spawnPoint[2] = 0;*/
+void TCPServer::broadcastMessage(const std::string_view message, int senderSocket) {
+    this->broadcastFrame(Frame::fromMessage(message), senderSocket);
+}
 
-                    /*finishPoint[0] = 400;
-                    finishPoint[1] = 1790;
-                    finishPoint[2] = 0;*/
-                    break;
-                case 6:
-                    this->setTeam(YELLOW);
-                    spawnPoint[0] = 2750;
-                    spawnPoint[1] = 1800;
-                    spawnPoint[2] = PI;
-
-                    finishPoint[0] = 2600;
-                    finishPoint[1] = 500;
-                    finishPoint[2] = PI / 2;
-                    break;
+void TCPServer::broadcastFrame(const FramePtr& frame, int senderSocket) {
+    SnapshotPtr snapshot = registry.snapshot();
+    for (int clientSocket : snapshot->sockets) {
+        if (clientSocket != senderSocket) { // Exclude the sender's socket
+            enqueue(snapshot->bySocket[clientSocket], frame);
+        }
+    }
+}
 
-                default:
-                    this->team = TEST;
-                    spawnPoint[0] = 1200;
-                    spawnPoint[1] = 1800;
-                    spawnPoint[2] = PI / 2;
+void TCPServer::sendToClient(const std::string_view message, int clientSocket) {
+    this->enqueue(clientSocket, Frame::fromMessage(message));
+}
+
+void TCPServer::sendToClient(const char *message, int clientSocket) {
+    this->sendToClient(std::string_view(message), clientSocket);
+}
+
+void TCPServer::sendToClient(const std::string &message, const std::string &clientName) {
+    this->sendToClient(message.c_str(), clientName);
+}
+
+void TCPServer::sendToClient(const char *message, const std::string &clientName) {
+    SnapshotPtr snapshot = registry.snapshot();
+    const std::vector<int>& destinations = snapshot->route(clientName);
+    if (destinations.empty()) {
+        return;
+    }
+
+    FramePtr frame = Frame::fromMessage(message);
+    for (int socket : destinations) {
+        enqueue(snapshot->bySocket[socket], frame);
+    }
+}
+
+void TCPServer::routeMessage(const std::string_view message, int senderSocket) {
+    this->routeFrame(Frame::fromMessage(message), senderSocket);
+}
+
+void TCPServer::routeFrame(const FramePtr& frame, int senderSocket) {
+    std::string_view message = frame->text;
+    std::array<std::string_view, 2> tokens;
+    // Broadcasts already reach every subscriber
+    if (TCPUtils::splitView(message, ';', tokens) < 2 || tokens[1] == "all") {
+        this->broadcastFrame(frame, senderSocket);
+        return;
+    }
+
+    SnapshotPtr snapshot = registry.snapshot();
+    const std::vector<int>& destinations = snapshot->route(tokens[1]);
+
+    // Nobody registered under this name, keep the old behaviour for clients that never sent ready
+    if (destinations.empty()) {
+        this->broadcastFrame(frame, senderSocket);
+        return;
+    }
+
+    for (int socket : destinations) {
+        if (socket != senderSocket) {
+            enqueue(snapshot->bySocket[socket], frame);
+        }
+    }
+
+    if (snapshot->topics) {
+        this->publishTopic(*snapshot, message, frame, senderSocket, destinations);
+    }
+}
+
+void TCPServer::publishTopic(const RegistrySnapshot& snapshot, const std::string_view message, FramePtr frame, const int senderSocket, const std::vector<int>& delivered) {
+    std::array<std::string_view, 3> tokens;
+    if (TCPUtils::splitView(message, ';', tokens) < 3) {
+        return;
+    }
+
+    std::pmr::vector<int> subscribers(scratch());
+    snapshot.topics->match(tokens[0], tokens[2], subscribers);
+    for (int socket : subscribers) {
+        if (socket == senderSocket || std::find(delivered.begin(), delivered.end(), socket) != delivered.end()) {
+            continue;
+        }
+        if (!frame) {
+            frame = Frame::fromMessage(message);
+        }
+        enqueue(snapshot.bySocket[socket], frame);
+    }
+}
+
+int TCPServer::addRoute(const std::string_view name, int clientSocket, const int features) {
+    if (clientSocket == -1) return -1;
+
+    int id = -1;
+    std::vector<ClientEntry> stale;
+    registry.update([name, clientSocket, features, &id, &stale](RegistrySnapshot& snapshot) {
+        if (!snapshot.find(clientSocket)) {
+            return;
+        }
+        id = snapshot.intern(name);
+        if (id == -1) {
+            std::cerr << "Too many client names, " << name << " is not routed" << std::endl;
+            return;
+        }
 
-                    finishPoint[0] = 1200;
-                    finishPoint[1] = 1800;
-                    finishPoint[2] = PI / 2;
-                    break;
+        // Nothing is routed to the old connection of a participant once the new one is published
+        if (static_cast<size_t>(id) < PARTICIPANTS.size()) {
+            std::vector<int> previous = snapshot.routes[id];
+            for (int socket : previous) {
+                if (socket != clientSocket) {
+                    stale.push_back(snapshot.bySocket[socket]);
+                    snapshot.remove(socket);
+                }
             }
+        }
 
-            std::ofstream file("end_point.txt");
-            file << finishPoint[0] << " " << finishPoint[1];
-            file.close();
-
-            this->robotPose = {spawnPoint[0], spawnPoint[1], spawnPoint[2]};
-            this->initRobotPose = {spawnPoint[0], spawnPoint[1], spawnPoint[2]};
-            this->endRobotPose = {finishPoint[0], finishPoint[1], finishPoint[2]};
-
-            for (int j = 0; j < 3; j++) {
-                this->setPosition(this->initRobotPose);
-                usleep(100'000);
-            }
+        ClientEntry& client = snapshot.bySocket[clientSocket];
+        client.features = features;
+        if (features & FEATURE_BINARY) {
+            client.queue->setBinary(true);
         }
-        else if (tokens[1] == "strat" && tokens[2] == "start")
-        {
-            if (this->gameStarted) {
-                return;
-            }
 
-            this->broadcastMessage(message, clientSocket);
+        // A client is routed under the last name it sent ready with
+        if (client.nameId != id) {
+            snapshot.unroute(clientSocket);
+            snapshot.routes[id].push_back(clientSocket);
+            client.nameId = id;
+        }
+    });
 
-            this->gameStarted = true;
+    for (const ClientEntry& client : stale) {
+        std::cout << "Retiring stale connection " << client.socket << " of " << name << std::endl;
+        retire(client);
+    }
+    return id;
+}
 
-            this->gameStart = std::chrono::system_clock::now();
+void TCPServer::retire(const ClientEntry& client) {
+    Reactor& reactor = *client.reactor;
+    {
+        std::lock_guard lock(reactor.mailboxMutex);
+        reactor.retired.emplace_back(client.socket, client.generation);
+    }
+    if (std::this_thread::get_id() != reactor.thread.get_id()) {
+        wakeupReactor(reactor);
+    }
+}
 
-            this->setSpeed(200);
+void TCPServer::enqueue(int clientSocket, const FramePtr& frame) {
+    SnapshotPtr snapshot = registry.snapshot();
+    if (const ClientEntry* client = snapshot->find(clientSocket)) {
+        enqueue(*client, frame);
+    }
+}
 
-            switch (this->team) {
-                case BLUE:
-                case YELLOW:
-                    this->gameThread = std::thread([this]() { this->startGame(); });
-                    break;
-                case TEST:
-                    this->gameThread = std::thread([this]() { this->startGameTest(); });
-                    break;
-            }
+void TCPServer::enqueue(const ClientEntry& client, const FramePtr& frame) {
+    if (!client.queue->push(frame)) {
+        std::cerr << "Outbound queue full or frame too large for client " << client.socket << ", dropping message" << std::endl;
+        return;
+    }
+    if (!client.queue->schedule()) {
+        return;
+    }
 
-            this->gameThread.detach();
-        }
+    Reactor& reactor = *client.reactor;
+    bool wasEmpty;
+    {
+        std::lock_guard lock(reactor.mailboxMutex);
+        wasEmpty = reactor.mailbox.empty();
+        reactor.mailbox.push_back(client.socket);
     }
-    else if (tokens[0] == "aruco" && tokens[2] == "get aruco") {
-        std::string arucoResponse = tokens[3];
-        if (arucoResponse != "404") {
-            std::vector<std::string> aruco = TCPUtils::split(arucoResponse, ",");
-            for (int i = 0; i < aruco.size() - 1; i += 7) {
-                ArucoTag tag;
-                tag.setId(std::stoi(aruco[i]));
-                tag.setName(aruco[i + 1]);
 
-                tag.setPos(std::stof(aruco[i + 2]), std::stof(aruco[i + 3]));
-                tag.setRot(std::stof(aruco[i + 4]), std::stof(aruco[i + 5]), std::stof(aruco[i + 6]));
+    // The reactor drains its mailbox after each batch of events anyway, and a non empty one was already woken
+    if (wasEmpty && std::this_thread::get_id() != reactor.thread.get_id()) {
+        wakeupReactor(reactor);
+    }
+}
 
-                // std::cout << tag << std::endl;
+void TCPServer::flushDirtyClients(Reactor& reactor) {
+    std::vector<int> toFlush;
+    std::vector<std::pair<int, uint32_t>> toRetire;
+    {
+        std::lock_guard lock(reactor.mailboxMutex);
+        toFlush.swap(reactor.mailbox);
+        toRetire.swap(reactor.retired);
+    }
 
-                handleArucoTag(tag);
-            }
-            // Broadcast the aruco tag to all clients
-            this->broadcastMessage(message, clientSocket);
+    for (const auto& [clientSocket, generation] : toRetire) {
+        // The stale connection may have closed by itself and its fd been reused since
+        auto handler = reactor.clientHandlers.find(clientSocket);
+        if (handler != reactor.clientHandlers.end() && handler->second.generation == generation) {
+            handler->second.closeConnection();
+            this->removeHandler(reactor, handler);
         }
     }
-    else if (tokens[0] == "arduino") {
-        if (tokens[2] == "set state") {
-            if (TCPUtils::startWith(tokens[3], "0")) {
-                this->isRobotIdle++;
-            }
-        } else if (tokens[2] == "set speed") {
-            this->speed = std::stoi(tokens[3]);
-        } else if (tokens[2] == "set pos") {
-            std::vector<std::string> pos = TCPUtils::split(tokens[3], ",");
-            this->robotPose = {std::stof(pos[0]), std::stof(pos[1]), std::stof(pos[2]) / 100};
-            if (!awaitForLidar) {
-                this->setPosition(this->robotPose, lidarSocket);
-            }
-        }
-    } else if (tokens[2] == "test aruco") {
-        int pince = std::stoi(tokens[3]);
 
-        std::thread([this, pince]() { this->startTestAruco(pince); }).detach();
+    for (int clientSocket : toFlush) {
+        this->flushClient(reactor, clientSocket);
     }
-    // std::cout << "Received: " << message << std::endl;
 }
 
-void TCPServer::broadcastMessage(const char* message, int senderSocket)
-{
-    std::string temp = std::string(message);
-    if (temp[temp.size() - 1] != '\n') {
-        temp += '\n';
+void TCPServer::flushClient(Reactor& reactor, int clientSocket) {
+    SnapshotPtr snapshot = registry.snapshot();
+    const ClientEntry* client = snapshot->find(clientSocket);
+    // The socket may already belong to a new client of another reactor
+    if (!client || client->reactor != &reactor) {
+        return;
     }
+    std::shared_ptr<OutboundQueue> queue = client->queue;
 
-    for (int clientSocket : clientSockets) {
-        if (clientSocket != senderSocket) { // Exclude the sender's socket
-            send(clientSocket, temp.c_str(), temp.length(), 0);
-        }
+    auto handler = reactor.clientHandlers.find(clientSocket);
+    if (handler == reactor.clientHandlers.end()) {
+        return;
     }
-}
 
-void TCPServer::broadcastMessage(const std::string &message, int senderSocket) {
-    std::string temp = const_cast<std::string&>(message);
-    if (temp[temp.size() - 1] != '\n') {
-        temp += '\n';
+    if (handler->second.shm) {
+        // A full ring is retried when the client rings the server eventfd
+        if (queue->flush(handler->second.shm->outbound()) == OutboundQueue::FAILED) {
+            std::cerr << "Shared memory ring of client " << clientSocket << " is corrupted" << std::endl;
+            handler->second.closeConnection();
+            this->removeHandler(reactor, handler);
+            return;
+        }
+        handler->second.shm->notifyClient();
+        return;
     }
 
-    for (int clientSocket : clientSockets) {
-        if (clientSocket != senderSocket) { // Exclude the sender's socket
-            send(clientSocket, temp.c_str(), temp.length(), 0);
+    if (reactor.uring) {
+        // The completion of the chain in flight flushes again, once paused the queue is handed off as it is
+        if (!handler->second.sending && !handoffRequested) {
+            this->submitSends(reactor, clientSocket, handler->second, *queue);
         }
+        return;
     }
-}
 
-void TCPServer::sendToClient(const std::string &message, int clientSocket) {
-    std::string temp = const_cast<std::string&>(message);
-    if (temp[temp.size() - 1] != '\n') {
-        temp += '\n';
+    OutboundQueue::FlushResult result = queue->flush(clientSocket);
+    if (result == OutboundQueue::FAILED) {
+        std::cerr << "Failed to send data." << clientSocket << std::endl;
+        handler->second.closeConnection();
+        this->removeHandler(reactor, handler);
+        return;
     }
 
-    for (int socket : clientSockets) {
-        if (socket == clientSocket) {
-            send(socket, temp.c_str(), temp.size(), 0);
-            break;
-        }
+    // Only listen for EPOLLOUT while the socket is full
+    bool waitForOutput = result == OutboundQueue::PENDING;
+    if (waitForOutput != handler->second.waitingForOutput) {
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | (waitForOutput ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+        event.data.fd = clientSocket;
+        epoll_ctl(reactor.epollFd, EPOLL_CTL_MOD, clientSocket, &event);
+        handler->second.waitingForOutput = waitForOutput;
     }
 }
 
-void TCPServer::sendToClient(const char *message, int clientSocket) {
-    std::string temp = std::string(message);
-    if (temp[temp.size() - 1] != '\n') {
-        temp += '\n';
-    }
-
-    for (int socket : clientSockets) {
-        if (socket == clientSocket) {
-            send(socket, temp.c_str(), temp.size(), 0);
-            break;
+int TCPServer::parseFeatures(std::string_view readyArgs) {
+    int features = 0;
+    std::string_view feature;
+    while (TCPUtils::nextToken(readyArgs, ',', feature)) {
+        if (feature == "ids") {
+            features |= FEATURE_REQUEST_ID;
+        } else if (feature == "bin") {
+            features |= FEATURE_BINARY;
         }
     }
+    return features;
 }
 
-void TCPServer::sendToClient(const std::string &message, const std::string &clientName) {
-    this->sendToClient(message.c_str(), clientName);
-}
+Reply TCPServer::request(const std::string_view destination, const std::string_view verb, const std::string_view args, const std::chrono::milliseconds timeout) {
+    std::promise<std::string> promise;
+    std::future<std::string> future = promise.get_future();
+    int id = requestTracker.add(destination, verb, std::move(promise));
 
-void TCPServer::sendToClient(const char *message, const std::string &clientName) {
-    for (auto & [name, socket, ready] : clients) {
-        if (name == clientName) {
-            send(socket, message, strlen(message), 0);
-            break;
-        }
+    bool sendId = false;
+    {
+        SnapshotPtr snapshot = registry.snapshot();
+        const std::vector<int>& destinations = snapshot->route(destination);
+        const ClientEntry* client = destinations.empty() ? nullptr : snapshot->find(destinations.front());
+        sendId = client && (client->features & FEATURE_REQUEST_ID);
+    }
+
+    std::string message = "strat;" + std::string(destination) + ";" + std::string(verb) + ";" + std::string(args);
+    if (sendId) {
+        message += ";" + std::to_string(id);
     }
+    this->routeMessage(message);
+
+    return {requestTracker, id, std::move(future), std::chrono::steady_clock::now() + timeout};
 }
 
 bool TCPServer::shouldStop() const {
@@ -389,33 +1674,88 @@ bool TCPServer::shouldStop() const {
 }
 
 void TCPServer::clientDisconnected(const int clientSocket) {
-    // Remove the disconnected client's socket
-    clientSockets.erase(std::remove(clientSockets.begin(), clientSockets.end(), clientSocket), clientSockets.end());
+    // Remove the disconnected client's socket, broadcasts still holding the previous snapshot only fill its dead queue
+    registry.update([clientSocket](RegistrySnapshot& snapshot) { snapshot.remove(clientSocket); });
     // Decrement the count of connected clients
     connectedClients--;
+
+    // The participant is no longer ready, its slot waits for the session to resume
+    std::lock_guard lock(dispatchMutex);
+    for (ClientTCP& client : clients) {
+        if (client.socket == clientSocket) {
+            client.isReady = false;
+            client.socket = -1;
+        }
+    }
+    if (this->lidarSocket == clientSocket) {
+        this->lidarSocket = -1;
+    }
+    if (this->arduinoSocket == clientSocket) {
+        this->arduinoSocket = -1;
+    }
 }
 
 void TCPServer::stop() {
     _shouldStop = true;
-    // Close all client sockets
-    for (int clientSocket : clientSockets) {
-        close(clientSocket);
+
+    // A handoff in progress either completes or resumes the reactors before they are stopped
+    if (handoffSocket != -1) {
+        shutdown(handoffSocket, SHUT_RDWR);
     }
-    // Join all threads before exiting
-    for (auto& thread : clientThreads) {
-        thread.join();
+    {
+        std::lock_guard lock(handoffMutex);
+        if (handoffPeer != -1) {
+            shutdown(handoffPeer, SHUT_RDWR);
+        }
+    }
+    if (handoffThread.joinable()) {
+        handoffThread.join();
+    }
+    if (handoffSocket != -1) {
+        close(handoffSocket);
+        // The next server already listens on the same path
+        if (!handedOff) {
+            unlink(handoffSocketPath.c_str());
+        }
+        handoffSocket = -1;
+    }
+
+    // Each reactor closes its client sockets before exiting
+    for (auto& reactor : reactors) {
+        if (reactor->thread.joinable()) {
+            wakeupReactor(*reactor);
+            reactor->thread.join();
+        }
     }
 
     if (gameStarted) {
         this->gameThread.~thread();
     }
 
-    // Close the server socket
-    close(serverSocket);
+    // Close the server sockets
+    for (auto& reactor : reactors) {
+        if (reactor->listenSocket != -1) {
+            close(reactor->listenSocket);
+            reactor->listenSocket = -1;
+        }
+    }
+
+    if (unixSocket != -1) {
+        close(unixSocket);
+        if (!handedOff) {
+            unlink(unixSocketPath.c_str());
+        }
+        unixSocket = -1;
+    }
 }
 
 TCPServer::~TCPServer() {
     this->stop();
+
+    for (auto& reactor : reactors) {
+        close(reactor->wakeupFd);
+        close(reactor->epollFd);
+    }
 }
 
 size_t TCPServer::nbClients() const {
@@ -424,15 +1764,37 @@ size_t TCPServer::nbClients() const {
 
 void TCPServer::start()
 {
-    std::thread([this]() { acceptConnections(); }).detach();
+    this->startReactors();
+
+    if (handoffSocket != -1) {
+        handoffThread = std::thread([this]() { runHandoffListener(); });
+    }
+}
+
+void TCPServer::startReactors()
+{
+    for (auto& reactor : reactors) {
+        reactor->thread = std::thread([this, &reactor = *reactor]() {
+            if (reactor.uring) {
+                runUringReactor(reactor);
+            } else {
+                runReactor(reactor);
+            }
+        });
+    }
 }
 
 void TCPServer::checkIfAllClientsReady()
 {
+    // A reconnection gets a snapshot instead of a new round of ready
+    if (allClientsReady) {
+        return;
+    }
+
     bool allReady = true;
-    for (auto&[name, socket, isReady] : clients)
+    for (auto&[name, socket, isReady, seen] : clients)
     {
-        if (!isReady)
+        if (!name.empty() && !isReady)
         {
             // std::cout << name << " is not ready" << std::endl;
             allReady = false;
@@ -441,6 +1803,8 @@ void TCPServer::checkIfAllClientsReady()
 
     if (allReady)
     {
+        allClientsReady = true;
+        this->publishPhase();
         this->broadcastMessage("strat;all;ready;1\n");
         std::thread([this]() { askArduinoPos(); }).detach();
     }
@@ -448,6 +1812,7 @@ void TCPServer::checkIfAllClientsReady()
 
 void TCPServer::startGame() {
     gameStarted = true;
+    this->publishPhase();
     for (int i = whereAmI; i < stratPatterns.size(); i++) {
 
         auto time = std::chrono::system_clock::now();
@@ -545,14 +1910,14 @@ void TCPServer::startGame() {
 }
 
 void TCPServer::startGameTest() {
-    this->broadcastMessage("strat;servo_moteur;baisser bras;1\n");
-    this->broadcastMessage("strat;servo_moteur;fermer pince;1\n");
-    this->broadcastMessage("strat;servo_moteur;fermer pince;2\n");
-    this->broadcastMessage("strat;servo_moteur;ouvrir pince;0\n");
-    this->broadcastMessage("strat;arduino;speed;200\n");
+    this->routeMessage("strat;servo_moteur;baisser bras;1\n");
+    this->routeMessage("strat;servo_moteur;fermer pince;1\n");
+    this->routeMessage("strat;servo_moteur;fermer pince;2\n");
+    this->routeMessage("strat;servo_moteur;ouvrir pince;0\n");
+    this->routeMessage("strat;arduino;speed;200\n");
 
-    arucoTags.clear();
-    this->broadcastMessage("strat;aruco;get aruco;1\n");
+    this->clearArucoTags();
+    this->sendMessage("aruco", GetArucoMessage{});
 
     int timeout = 0;
     ArucoTag tag;
@@ -567,7 +1932,7 @@ void TCPServer::startGameTest() {
         }
 
         if (!found) {
-            this->broadcastMessage("start;aruco;get aruco;1");
+            this->sendMessage("aruco", GetArucoMessage{});
             usleep(500'000);
             timeout++;
             if (timeout > 10) {
@@ -589,16 +1954,16 @@ void TCPServer::startGameTest() {
     }
 
     // pi/4
-    this->broadcastMessage("strat;arduino;angle;314\n");
+    this->routeMessage("strat;arduino;angle;314\n");
     if (awaitRobotIdle() < 0) return;
 
     // ReSharper disable once CppDFAUnreachableCode
 
-    this->broadcastMessage("strat;servo_moteur;baisser bras;1\n");
+    this->routeMessage("strat;servo_moteur;baisser bras;1\n");
 
     usleep(2'000'000);
-    arucoTags.clear();
-    this->broadcastMessage("strat;aruco;get aruco;1\n");
+    this->clearArucoTags();
+    this->sendMessage("aruco", GetArucoMessage{});
 
     found = false;
     timeout = 0;
@@ -612,7 +1977,7 @@ void TCPServer::startGameTest() {
         }
 
         if (!found) {
-            this->broadcastMessage("start;aruco;get aruco;1");
+            this->sendMessage("aruco", GetArucoMessage{});
             usleep(500'000);
             timeout++;
             if (timeout > 10) {
@@ -631,14 +1996,14 @@ void TCPServer::startGameTest() {
         return;
     }
 
-    this->broadcastMessage("strat;arduino;angle;157\n");
+    this->routeMessage("strat;arduino;angle;157\n");
     if (awaitRobotIdle() < 0) return;
 
-    // this->broadcastMessage("strat;servo_moteur;baisser bras;1\n");
+    // this->routeMessage("strat;servo_moteur;baisser bras;1\n");
 
     usleep(2'000'000);
-    arucoTags.clear();
-    this->broadcastMessage("strat;aruco;get aruco;1\n");
+    this->clearArucoTags();
+    this->sendMessage("aruco", GetArucoMessage{});
 
     found = false;
     timeout = 0;
@@ -652,7 +2017,7 @@ void TCPServer::startGameTest() {
         }
 
         if (!found) {
-            this->broadcastMessage("start;aruco;get aruco;1");
+            this->sendMessage("aruco", GetArucoMessage{});
             usleep(500'000);
             timeout++;
             if (timeout > 10) {
@@ -673,48 +2038,48 @@ void TCPServer::startGameTest() {
 
     // go to jardinière
 
-    this->broadcastMessage("strat;servo_moteur;lever bras;1\n");
+    this->routeMessage("strat;servo_moteur;lever bras;1\n");
 
     std::string toSend = "strat;arduino;go;762,300\n";
-    this->broadcastMessage(toSend);
+    this->routeMessage(toSend);
     usleep(200'000);
     if (awaitRobotIdle() < 0) return;
 
-    this->broadcastMessage("strat;arduino;angle;157\n");
+    this->routeMessage("strat;arduino;angle;157\n");
     if (awaitRobotIdle() < 0) return;
 
-    this->broadcastMessage("strat;arduino;speed;150\n");
-    this->broadcastMessage("strat;arduino;go;762,0\n");
+    this->routeMessage("strat;arduino;speed;150\n");
+    this->routeMessage("strat;arduino;go;762,0\n");
     usleep(4'000'000);
 
-    this->broadcastMessage("strat;servo_moteur;ouvrir pince;0\n");
-    pinceState[0] = NONE;
-    this->broadcastMessage("strat;servo_moteur;ouvrir pince;2\n");
-    pinceState[2] = NONE;
+    this->routeMessage("strat;servo_moteur;ouvrir pince;0\n");
+    this->setPinceState(0, NONE);
+    this->routeMessage("strat;servo_moteur;ouvrir pince;2\n");
+    this->setPinceState(2, NONE);
     usleep(200'000);
 
-    this->broadcastMessage("strat;servo_moteur;fermer pince;0\n");
-    this->broadcastMessage("strat;servo_moteur;fermer pince;2\n");
-    this->broadcastMessage("strat;servo_moteur;ouvrir pince;1\n");
-    pinceState[1] = NONE;
+    this->routeMessage("strat;servo_moteur;fermer pince;0\n");
+    this->routeMessage("strat;servo_moteur;fermer pince;2\n");
+    this->routeMessage("strat;servo_moteur;ouvrir pince;1\n");
+    this->setPinceState(1, NONE);
     usleep(200'000);
 
-    this->broadcastMessage("strat;arduino;speed;200\n");
+    this->routeMessage("strat;arduino;speed;200\n");
 
     toSend = "strat;arduino;go;" + std::to_string(static_cast<int>(this->endRobotPose.pos.x)) + "," + std::to_string(static_cast<int>(this->endRobotPose.pos.y)) + "\n";
-    this->broadcastMessage(toSend);
+    this->routeMessage(toSend);
     if (awaitRobotIdle() < 0) return;
 
     toSend = "strat;arduino;angle;" + std::to_string(static_cast<int>(this->endRobotPose.theta * 100)) + "\n";
-    this->broadcastMessage(toSend);
+    this->routeMessage(toSend);
     if (awaitRobotIdle() < 0) return;
 
     // toSend = "start;arduino;angle;" + std::to_string(this->endRobotPose.theta * 100) + "\n";
-    // this->broadcastMessage(toSend);
+    // this->routeMessage(toSend);
 
-    this->broadcastMessage("strat;servo_moteur;baisser bras;1");
+    this->routeMessage("strat;servo_moteur;baisser bras;1");
 
-    this->broadcastMessage("strat;servo_moteur;clear;1");
+    this->routeMessage("strat;servo_moteur;clear;1");
 }
 
 
@@ -769,56 +2134,364 @@ void TCPServer::goToAruco(const ArucoTag &arucoTag, const int pince) {
     this->closePince(pince);
     usleep(500'000);
     this->setSpeed(200);
-    pinceState[pince] = TCPUtils::startWith(arucoTag.name(), "Purple_flower") ? PURPLE_FLOWER : WHITE_FLOWER;
+    this->setPinceState(pince, TCPUtils::startWith(arucoTag.name(), "Purple_flower") ? PURPLE_FLOWER : WHITE_FLOWER);
     this->transportBras();
 }
 
 void TCPServer::askArduinoPos() {
-    for (const auto & client : clients) {
-        if (client.name == "arduino") {
-            this->arduinoSocket = client.socket;
-            break;
-        }
-    }
+    this->arduinoSocket = clients[PARTICIPANT_ARDUINO].socket;
 
     if (this->arduinoSocket == -1) {
         return;
     }
 
-    while (!this->_shouldStop) {
-        this->sendToClient("strat;arduino;get pos;1\n", this->arduinoSocket);
+    // Ask the arduino to push its position by itself, at most every period or when it moved more than the threshold
+    this->arduinoPoseStreaming = false;
+    this->sendToClient("strat;arduino;subscribe pos;" + std::to_string(POSE_STREAM_PERIOD_MS) + "," + std::to_string(POSE_STREAM_THRESHOLD) + "\n", this->arduinoSocket);
+
+    for (int i = 0; i < 25 && !this->arduinoPoseStreaming; i++) {
         usleep(20'000);
     }
+
+    // Older bridges do not know subscribe pos, keep polling them
+    while (!this->_shouldStop && !this->arduinoPoseStreaming) {
+        this->enqueue(this->arduinoSocket, arduinoGetPos);
+        usleep(POSE_STREAM_PERIOD_MS * 1000);
+    }
+}
+
+bool TCPServer::participantReady(const int nameId, const int clientSocket) {
+    // Only the participants of the match have a slot, observers are routed but never waited for
+    if (nameId < 0 || static_cast<size_t>(nameId) >= clients.size() || clients[nameId].name.empty()) {
+        return false;
+    }
+
+    ClientTCP& client = clients[nameId];
+    bool resumed = client.seen;
+    client.isReady = true;
+    client.seen = true;
+    client.socket = clientSocket;
+    if (nameId == PARTICIPANT_LIDAR) {
+        this->lidarSocket = clientSocket;
+    } else if (nameId == PARTICIPANT_ARDUINO) {
+        // The pose polling sends to the new socket from now on
+        this->arduinoSocket = clientSocket;
+    }
+    std::cout << client.socket << " | " << client.name << (resumed ? " resumed its session" : " is ready") << std::endl;
+    return resumed;
+}
+
+void TCPServer::sendSnapshot(const std::string_view name, const int clientSocket) {
+    std::string prefix = "strat;" + std::string(name) + ";";
+
+    // Queued together, they leave in the same write
+    this->sendMessage(name, poseMessage(robotPose), clientSocket);
+    this->sendToClient(prefix + "set speed;" + std::to_string(speed) + "\n", clientSocket);
+    this->sendToClient(prefix + "set team;" + std::to_string(team) + "\n", clientSocket);
+    this->sendToClient(prefix + "set pince;" + std::to_string(pinceState[0]) + "," + std::to_string(pinceState[1]) + "," + std::to_string(pinceState[2]) + "\n", clientSocket);
+    this->sendToClient(prefix + "set phase;" + std::string(gamePhase()) + "\n", clientSocket);
+
+    // The subscription died with the old connection
+    if (clientSocket == this->arduinoSocket && this->arduinoPoseStreaming) {
+        this->sendToClient("strat;arduino;subscribe pos;" + std::to_string(POSE_STREAM_PERIOD_MS) + "," + std::to_string(POSE_STREAM_THRESHOLD) + "\n", clientSocket);
+    }
+}
+
+void TCPServer::addPoseSubscriber(int clientSocket) {
+    registry.update([clientSocket](RegistrySnapshot& snapshot) {
+        if (snapshot.find(clientSocket)) {
+            snapshot.bySocket[clientSocket].poseSubscriber = true;
+        }
+    });
+}
+
+void TCPServer::removePoseSubscriber(int clientSocket) {
+    registry.update([clientSocket](RegistrySnapshot& snapshot) {
+        if (snapshot.find(clientSocket)) {
+            snapshot.bySocket[clientSocket].poseSubscriber = false;
+        }
+    });
+}
+
+void TCPServer::watchKeys(int clientSocket, uint32_t keys, bool watch) {
+    registry.update([clientSocket, keys, watch](RegistrySnapshot& snapshot) {
+        if (snapshot.find(clientSocket)) {
+            uint32_t& watched = snapshot.bySocket[clientSocket].watchedKeys;
+            watched = watch ? watched | keys : watched & ~keys;
+        }
+    });
+}
+
+void TCPServer::publishPose() {
+    SnapshotPtr snapshot = registry.snapshot();
+    FramePtr frame;
+    for (int socket : snapshot->sockets) {
+        const ClientEntry& client = snapshot->bySocket[socket];
+        if (!client.poseSubscriber) {
+            continue;
+        }
+        // Only format the pose once somebody wants it
+        if (!frame) {
+            Messages::Buffer buffer;
+            frame = Frame::fromMessage(Messages::encode("strat", "all", poseMessage(robotPose), buffer));
+        }
+        enqueue(client, frame);
+    }
+}
+
+void TCPServer::subscribeTopics(std::string_view patterns, const int clientSocket) {
+    std::vector<std::string> added;
+    std::string_view pattern;
+    while (TCPUtils::nextToken(patterns, ',', pattern)) {
+        if (!TopicMatcher::validPattern(pattern)) {
+            std::cerr << "Invalid topic pattern : " << pattern << std::endl;
+            continue;
+        }
+        added.emplace_back(pattern);
+    }
+    if (added.empty()) {
+        return;
+    }
+
+    registry.update([clientSocket, &added](RegistrySnapshot& snapshot) {
+        if (!snapshot.find(clientSocket)) {
+            return;
+        }
+        auto& topics = snapshot.bySocket[clientSocket].topics;
+        for (auto& pattern : added) {
+            if (std::find(topics.begin(), topics.end(), pattern) == topics.end()) {
+                topics.push_back(std::move(pattern));
+            }
+        }
+        snapshot.compileTopics();
+    });
+}
+
+void TCPServer::unsubscribeTopics(std::string_view patterns, const int clientSocket) {
+    std::vector<std::string> removed;
+    std::string_view pattern;
+    while (TCPUtils::nextToken(patterns, ',', pattern)) {
+        removed.emplace_back(pattern);
+    }
+
+    registry.update([clientSocket, &removed](RegistrySnapshot& snapshot) {
+        if (!snapshot.find(clientSocket)) {
+            return;
+        }
+        auto& topics = snapshot.bySocket[clientSocket].topics;
+        bool all = std::find(removed.begin(), removed.end(), "all") != removed.end();
+        topics.erase(std::remove_if(topics.begin(), topics.end(), [all, &removed](const std::string& topic) {
+            return all || std::find(removed.begin(), removed.end(), topic) != removed.end();
+        }), topics.end());
+        snapshot.compileTopics();
+    });
+}
+
+void TCPServer::setState(const StateKey key, std::string value) {
+    // Enqueued under the store lock, two threads setting the key cannot leave the older value last in a queue
+    store.set(key, std::move(value), [this, key](const uint64_t version, const std::string& stored) {
+        SnapshotPtr snapshot = registry.snapshot();
+        FramePtr frame;
+        for (int socket : snapshot->sockets) {
+            const ClientEntry& client = snapshot->bySocket[socket];
+            if (!(client.watchedKeys & (1u << key))) {
+                continue;
+            }
+            if (!frame) {
+                frame = Frame::fromMessage("strat;all;set value;" + std::string(STATE_KEYS[key]) + "," + std::to_string(version) + "," + stored);
+            }
+            enqueue(client, frame);
+        }
+    });
+}
+
+void TCPServer::sendValue(const std::string_view name, const std::string_view key, const int clientSocket) {
+    int stateKey = StateStore::keyOf(key);
+    if (stateKey == -1) {
+        std::cerr << "Unknown state key : " << key << std::endl;
+        return;
+    }
+
+    this->sendStoredValue(name, static_cast<StateKey>(stateKey), store.get(static_cast<StateKey>(stateKey)), clientSocket);
+}
+
+void TCPServer::watchValues(const std::string_view name, const std::string_view args, const int clientSocket) {
+    size_t comma = args.find(',');
+    uint64_t since;
+    if (!TCPUtils::parseNumber(args.substr(0, comma), since)) {
+        std::cerr << "Invalid watch values : " << args << std::endl;
+        return;
+    }
+    uint32_t keys = comma == std::string_view::npos ? STATE_ALL_KEYS : parseKeys(args.substr(comma + 1));
+
+    // Watch first, a value set meanwhile is sent twice with the same version rather than missed
+    this->watchKeys(clientSocket, keys, true);
+
+    for (const auto& [key, stored] : store.changedSince(since, keys)) {
+        this->sendStoredValue(name, key, stored, clientSocket);
+    }
+}
+
+void TCPServer::sendStoredValue(const std::string_view name, const StateKey key, const StateValue& stored, const int clientSocket) {
+    // The aruco value is too long for a Messages::Buffer
+    char version[20];
+    auto end = std::to_chars(version, version + sizeof(version), stored.version).ptr;
+
+    std::pmr::string line(scratch());
+    line.reserve(name.size() + STATE_KEYS[key].size() + stored.value.size() + 48);
+    line.append("strat;").append(name).append(";set value;").append(STATE_KEYS[key]).append(",");
+    line.append(version, end).append(",").append(stored.value).append("\n");
+    this->sendToClient(line, clientSocket);
+}
+
+std::pmr::memory_resource* TCPServer::scratch() {
+    return reactorArena ? reactorArena : std::pmr::get_default_resource();
+}
+
+uint32_t TCPServer::parseKeys(std::string_view keys) {
+    uint32_t mask = 0;
+    std::string_view name;
+    while (TCPUtils::nextToken(keys, ',', name)) {
+        if (name == "all") {
+            return STATE_ALL_KEYS;
+        }
+        int key = StateStore::keyOf(name);
+        if (key == -1) {
+            std::cerr << "Unknown state key : " << name << std::endl;
+            continue;
+        }
+        mask |= 1u << key;
+    }
+    return mask;
+}
+
+std::string TCPServer::formatPose(const Position& pos) {
+    Messages::Buffer buffer;
+    return std::string(Messages::encodeFields(poseMessage(pos), buffer));
+}
+
+std::string_view TCPServer::gamePhase() const {
+    if (gameStarted) {
+        return "running";
+    }
+    return allClientsReady ? "ready" : "waiting";
+}
+
+void TCPServer::publishPhase() {
+    this->setState(STATE_PHASE, std::string(gamePhase()));
+}
+
+void TCPServer::setPinceState(const int pince, const PinceState state) {
+    pinceState[pince] = state;
+    this->publishPinces();
+}
+
+void TCPServer::publishPinces() {
+    this->setState(STATE_PINCE, std::to_string(pinceState[0]) + "," + std::to_string(pinceState[1]) + "," + std::to_string(pinceState[2]));
+}
+
+void TCPServer::clearArucoTags() {
+    arucoTags.clear();
+    this->publishArucoTags();
+}
+
+void TCPServer::publishArucoTags() {
+    std::string tags;
+    for (const auto& tag : arucoTags) {
+        auto [x, y] = tag.pos();
+        auto [rotX, rotY, rotZ] = tag.rot();
+        if (!tags.empty()) {
+            tags += ",";
+        }
+        tags += std::to_string(tag.id()) + "," + tag.name() + "," + std::to_string(x) + "," + std::to_string(y) + "," +
+                std::to_string(rotX) + "," + std::to_string(rotY) + "," + std::to_string(rotZ);
+    }
+    this->setState(STATE_ARUCO, tags);
+}
+
+void TCPServer::startMotion() {
+    std::lock_guard lock(motionMutex);
+    this->startMotionLocked();
+    motionIssued = true;
+}
+
+void TCPServer::startMotionLocked() {
+    motionCommandId++;
+    idleReports = 0;
+    sawRobotMoving = false;
+}
+
+void TCPServer::onArduinoState(const bool idle) {
+    std::lock_guard lock(motionMutex);
+    if (!idle) {
+        sawRobotMoving = true;
+        return;
+    }
+
+    idleReports++;
+    // An idle report after seeing the robot move ends the motion at once,
+    // otherwise wait for a second one in case the first was sent before the command was read
+    if (sawRobotMoving || idleReports >= 2) {
+        completedMotionId = motionCommandId;
+        motionCondition.notify_all();
+    }
 }
 
 int TCPServer::awaitRobotIdle() {
-    isRobotIdle = 0;
-    int timeout = 0;
-    // ReSharper disable once CppDFAConstantConditions
-    // ReSharper disable once CppDFAEndlessLoop
-    usleep(50'000);
-    while (isRobotIdle < 2) {
-        usleep(50'000);
-        this->sendToClient("strat;arduino;get state;1\n", this->arduinoSocket);
+    std::unique_lock lock(motionMutex);
+
+    // Commands sent without go, rotate or transit still get their own completion
+    if (!motionIssued) {
+        this->startMotionLocked();
+    }
+    motionIssued = false;
+
+    const uint64_t motionId = motionCommandId;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(MOTION_TIMEOUT_MS);
+
+    while (completedMotionId < motionId) {
+        // Bridges that do not push their state changes only answer get state
+        bool notified = motionCondition.wait_for(lock, std::chrono::milliseconds(STATE_POLL_PERIOD_MS), [this, motionId]() {
+            return completedMotionId >= motionId || stopEmergency;
+        });
+
         if (stopEmergency) {
+            lock.unlock();
             while (stopEmergency) {
                 stopEmergency = false;
                 usleep(300'000);
             }
-            this->broadcastMessage(lastArduinoCommand);
-            awaitRobotIdle();
+            if (FramePtr command = std::atomic_load(&lastArduinoCommand)) {
+                this->routeFrame(command);
+            }
+            lock.lock();
+
+            idleReports = 0;
+            sawRobotMoving = false;
+            deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(MOTION_TIMEOUT_MS);
+            continue;
+        }
+
+        if (notified) {
+            break;
         }
+
         if (gameStarted) {
             auto time = std::chrono::system_clock::now();
             if (time - gameStart > std::chrono::seconds(87)) {
                 return -1;
             }
         }
-        timeout++;
-        if (timeout > 80) {
-            this->broadcastMessage("strat;arduino;clear;1");
+
+        if (std::chrono::steady_clock::now() > deadline) {
+            lock.unlock();
+            this->routeMessage("strat;arduino;clear;1");
             return 1;
         }
+
+        lock.unlock();
+        this->enqueue(this->arduinoSocket, arduinoGetState);
+        lock.lock();
     }
     return 0;
 }
@@ -928,7 +2601,7 @@ std::vector<PinceState> TCPServer::getNotFallenFlowers() const {
 void TCPServer::handleEmergency(int distance, double angle) {
     /*this->handleEmergencyFlag = true;
 
-    this->broadcastMessage("strat;arduino;clear;2\n");
+    this->routeMessage("strat;arduino;clear;2\n");
 
     // TODO handle here the emergency like wait for 2 second and then if emergency is again on, that means the robot of the other team do not move, if that go back otherwise continue
     usleep(2'000'000);
@@ -936,7 +2609,7 @@ void TCPServer::handleEmergency(int distance, double angle) {
     while (this->stopEmergency) {
         // TODO here go back by twenty centimeter
         // ReSharper disable once CppDFAUnreachableCode
-        this->broadcastMessage("strat;arduino;clear;3\n");
+        this->routeMessage("strat;arduino;clear;3\n");
 
         this->stopEmergency = false;
 
@@ -949,7 +2622,7 @@ void TCPServer::handleEmergency(int distance, double angle) {
         this->go(newX, newY);
         if (awaitRobotIdle() < 0) return;*/
     /*}
-    this->broadcastMessage("strat;arduino;clear;4\n");
+    this->routeMessage("strat;arduino;clear;4\n");
 
     try {
         this->gameThread.~thread();
@@ -958,6 +2631,7 @@ void TCPServer::handleEmergency(int distance, double angle) {
     }
 
     this->gameStarted = false;
+    this->publishPhase();
 
     this->gameThread = std::thread([this]() { this->startGame(); });
 
@@ -967,18 +2641,18 @@ void TCPServer::handleEmergency(int distance, double angle) {
 }
 
 void TCPServer::startTestAruco(const int pince) {
-    this->arucoTags.clear();
+    this->clearArucoTags();
     std::optional<ArucoTag> tag = std::nullopt;
 
     for (int i = 0; i < 5; i++) {
-        this->broadcastMessage("strat;aruco;get aruco;1\n");
+        this->sendMessage("aruco", GetArucoMessage{});
         usleep(220'000);
     }
     tag = getMostCenteredArucoTag(100, 800, -400, 400);
 
     int timeout = 0;
     while (!tag.has_value()) {
-        this->broadcastMessage("strat;aruco;get aruco;1\n");
+        this->sendMessage("aruco", GetArucoMessage{});
         usleep(220'000);
         tag = getMostCenteredArucoTag(100, 800, -400, 400);
 
@@ -1023,7 +2697,7 @@ void TCPServer::goEnd() {
     }
     this->sendPoint(10);
 
-    this->broadcastMessage("strat;all;end;1");
+    this->routeMessage("strat;all;end;1");
 }
 
 void TCPServer::findAndGoFlower(const StratPattern sp) {
@@ -1066,18 +2740,18 @@ void TCPServer::findAndGoFlower(const StratPattern sp) {
         return;
     }
 
-    this->arucoTags.clear();
+    this->clearArucoTags();
     std::optional<ArucoTag> tag = std::nullopt;
 
     for (int i = 0; i < 5; i++) {
-        this->broadcastMessage("strat;aruco;get aruco;1\n");
+        this->sendMessage("aruco", GetArucoMessage{});
         usleep(110'000);
     }
     tag = getMostCenteredArucoTag(300, 700, -200, 200);
 
     int timeout = 0;
     while (!tag.has_value()) {
-        this->broadcastMessage("strat;aruco;get aruco;1\n");
+        this->sendMessage("aruco", GetArucoMessage{});
         usleep(110'000);
         tag = getMostCenteredArucoTag(300, 700, -200, 200);
 
@@ -1150,7 +2824,7 @@ void TCPServer::dropPurpleFlowers() {
             this->go(this->robotPose.pos.x, this->robotPose.pos.y + 150);
             if (awaitRobotIdle() < 0) return;
 
-            pinceState[toDrop] = NONE;
+            this->setPinceState(toDrop, NONE);
             this->closePince(toDrop);
             usleep(200'000);
 
@@ -1232,7 +2906,7 @@ void TCPServer::dropWhiteFlowers(const StratPattern sp) {
             this->openPince(i);
             usleep(1'000'000);
 
-            pinceState[i] = NONE;
+            this->setPinceState(i, NONE);
             this->closePince(i);
             usleep(100'000);
 
@@ -1386,11 +3060,11 @@ void TCPServer::dropJardiniereFlowers(const StratPattern sp) {
 
     if (pinceState[0] != NONE) {
         this->fullyOpenPince(0);
-        pinceState[0] = NONE;
+        this->setPinceState(0, NONE);
     }
     if (pinceState[2] != NONE) {
         this->fullyOpenPince(2);
-        pinceState[2] = NONE;
+        this->setPinceState(2, NONE);
     }
 
     usleep(500'000);
@@ -1402,7 +3076,7 @@ void TCPServer::dropJardiniereFlowers(const StratPattern sp) {
 
     if (pinceState[1] != NONE) {
         this->fullyOpenPince(1);
-        pinceState[1] = NONE;
+        this->setPinceState(1, NONE);
     }
 
     this->sendPoint(3+1);
@@ -1501,7 +3175,7 @@ void TCPServer::dropBaseFlowers(StratPattern sp) {
             this->sendPoint(3);
         }
 
-        pinceState[i] = NONE;
+        this->setPinceState(i, NONE);
         this->closePince(i);
     }
 
@@ -1589,7 +3263,7 @@ void TCPServer::go3Plants(const StratPattern sp) {
 
     // this->arucoTags.clear();
     // for (int i = 0; i < 5; i++) {
-        // this->broadcastMessage("strat;aruco;get aruco;1\n");
+        // this->routeMessage("strat;aruco;get aruco;1\n");
         // usleep(110'000);
     // }
 
@@ -1609,7 +3283,7 @@ void TCPServer::go3Plants(const StratPattern sp) {
 
     for (int i = 0; i < 3; i++) {
         this->closePince(i);
-        pinceState[i] = FLOWER;
+        this->setPinceState(i, FLOWER);
     }
     usleep(500'000);
 
@@ -1669,9 +3343,7 @@ void TCPServer::removePot(StratPattern sp) {
 
 void TCPServer::getLidarPos() {
 
-    this->lidarGetPosTimeout = 0;
-
-    this->broadcastMessage("strat;arduino;clear;1\n");
+    this->routeMessage("strat;arduino;clear;1\n");
 
     usleep(1'000'000);
 
@@ -1679,23 +3351,32 @@ void TCPServer::getLidarPos() {
 
     usleep(100'000);
 
-    awaitForLidar = true;
-
-    this->askLidarPosition();
-
-    int timeout = 0;
+    // The lidar answers -1,-1 while it has no position yet, ask again
+    for (int attempt = 0; attempt <= 10; attempt++) {
+        std::optional<std::string> reply = this->request("lidar", "get pos", "1", std::chrono::milliseconds(500)).get();
+        if (!reply.has_value()) {
+            continue;
+        }
 
-    // ReSharper disable once CppDFAConstantConditions
-    // ReSharper disable once CppDFAEndlessLoop
-    while (awaitForLidar) {
-        usleep(50'000);
-        timeout++;
-        if (timeout > 100) {
-            break;
+        std::array<std::string_view, 3> args;
+        float x, y;
+        if (TCPUtils::splitView(*reply, ',', args) < 2 || !TCPUtils::parseNumber(args[0], x) || !TCPUtils::parseNumber(args[1], y)) {
+            std::cerr << "Invalid lidar position : " << *reply << std::endl;
+            continue;
+        }
+        if (x == -1 || y == -1) {
+            continue;
         }
+
+        // TODO replace angle with the real angle calculated by the lidar when working
+        this->lidarCalculatePos = {x, y, /*args[2] / 100*/ this->robotPose.theta};
+        this->setState(STATE_LIDAR_POSE, formatPose(lidarCalculatePos));
+        this->setPosition(this->lidarCalculatePos);
+        usleep(100'000);
+        this->setPosition(this->lidarCalculatePos);
+        break;
     }
 
-    // ReSharper disable once CppDFAUnreachableCode
     std::cout << lidarCalculatePos.pos.x << " " << lidarCalculatePos.pos.y << " " << lidarCalculatePos.theta << std::endl;
 
 }
@@ -1737,25 +3418,23 @@ void TCPServer::checkpoint(const StratPattern sp) {
 
 template<class X, class Y>
 void TCPServer::go(X x, Y y) {
-    lastArduinoCommand = "strat;arduino;go;" + std::to_string(static_cast<int>(x)) + "," + std::to_string(static_cast<int>(y)) + "\n";
-    this->broadcastMessage("strat;arduino;go;" + std::to_string(static_cast<int>(x)) + "," + std::to_string(static_cast<int>(y)) + "\n");
+    this->sendMotion(GoMessage{static_cast<int>(x), static_cast<int>(y)});
 }
 
 template<class X>
 void TCPServer::go(std::array<X, 2> data) {
-    lastArduinoCommand = "strat;arduino;go;" + std::to_string(static_cast<int>(data[0])) + "," + std::to_string(static_cast<int>(data[1])) + "\n";
-    this->broadcastMessage("strat;arduino;go;" + std::to_string(static_cast<int>(data[0])) + "," + std::to_string(static_cast<int>(data[1])) + "\n");
+    this->go(data[0], data[1]);
 }
 
 template<class X>
 void TCPServer::rotate(X angle) {
-    lastArduinoCommand = "strat;arduino;angle;" + std::to_string(static_cast<int>(angle * 100)) + "\n";
-    this->broadcastMessage("strat;arduino;angle;" + std::to_string(static_cast<int>(angle * 100)) + "\n");
+    this->sendMotion(AngleMessage{static_cast<float>(angle * 100)});
 }
 
 void TCPServer::setSpeed(const int speed) {
-    this->broadcastMessage("strat;arduino;speed;" + std::to_string(speed) + "\n");
+    this->sendMessage("arduino", SpeedMessage{speed});
     this->speed = speed;
+    this->setState(STATE_SPEED, std::to_string(speed));
 }
 
 void TCPServer::setMaxSpeed() {
@@ -1768,101 +3447,114 @@ void TCPServer::setMinSpeed() {
 
 template<class X, class Y>
 void TCPServer::transit(X x, Y y, const int endSpeed) {
-    lastArduinoCommand = "strat;arduino;transit;" + std::to_string(static_cast<int>(x)) + "," + std::to_string(static_cast<int>(y)) + "," + std::to_string(endSpeed) + "\n";
-    this->broadcastMessage("strat;arduino;transit;" + std::to_string(static_cast<int>(x)) + "," + std::to_string(static_cast<int>(y)) + "," + std::to_string(endSpeed) + "\n");
+    this->sendMotion(TransitMessage{static_cast<int>(x), static_cast<int>(y), endSpeed});
 }
 
 template<class X>
 void TCPServer::transit(std::array<X, 2> data, const int endSpeed) {
-    lastArduinoCommand = "strat;arduino;transit;" + std::to_string(static_cast<int>(data[0])) + "," + std::to_string(static_cast<int>(data[1])) + "," + std::to_string(endSpeed) + "\n";
-    this->broadcastMessage("strat;arduino;transit;" + std::to_string(static_cast<int>(data[0])) + "," + std::to_string(static_cast<int>(data[1])) + "," + std::to_string(endSpeed) + "\n");
+    this->transit(data[0], data[1], endSpeed);
 }
 
 template<class X, class Y, class Z>
 void TCPServer::setPosition(X x, Y y, Z theta, const int clientSocket) {
-    if (clientSocket == -1) {
-        this->broadcastMessage("strat;all;set pos;" + std::to_string(static_cast<int>(x)) + "," + std::to_string(static_cast<int>(y)) + "," + std::to_string(static_cast<int>(theta * 100)) + "\n");
-    } else {
-        this->sendToClient("strat;all;set pos;" + std::to_string(static_cast<int>(x)) + "," + std::to_string(static_cast<int>(y)) + "," + std::to_string(static_cast<int>(theta * 100)) + "\n", clientSocket);
-    }
+    this->sendMessage("all", PoseMessage{static_cast<float>(x), static_cast<float>(y), static_cast<float>(theta * 100)}, clientSocket);
 }
 
 template<class X>
 void TCPServer::setPosition(std::array<X, 3> data, const int clientSocket) {
-    if (clientSocket == -1) {
-        this->broadcastMessage("strat;all;set pos;" + std::to_string(static_cast<int>(data[0])) + "," + std::to_string(static_cast<int>(data[1])) + "," + std::to_string(static_cast<int>(data[2] * 100)) + "\n");
-    } else {
-        this->sendToClient("strat;all;set pos;" + std::to_string(static_cast<int>(data[0])) + "," + std::to_string(static_cast<int>(data[1])) + "," + std::to_string(static_cast<int>(data[2] * 100)) + "\n", clientSocket);
-    }
+    this->setPosition(data[0], data[1], data[2], clientSocket);
 }
 
 void TCPServer::setPosition(const Position pos, const int clientSocket) {
-    if (clientSocket == -1) {
-        this->broadcastMessage("strat;all;set pos;" + std::to_string(static_cast<int>(pos.pos.x)) + "," + std::to_string(static_cast<int>(pos.pos.y)) + "," + std::to_string(static_cast<int>(pos.theta * 100)) + "\n");
-    } else {
-        this->sendToClient("strat;lidar;set pos;" + std::to_string(static_cast<int>(pos.pos.x)) + "," + std::to_string(static_cast<int>(pos.pos.y)) + "," + std::to_string(static_cast<int>(pos.theta * 100)) + "\n", clientSocket);
-    }
+    this->sendMessage(clientSocket == -1 ? "all" : "lidar", poseMessage(pos), clientSocket);
 }
 
 template<class X, class Y, class Z>
 void TCPServer::setPosition(X x, Y y, Z theta, const std::string &toSend) {
-    this->broadcastMessage("strat;" + toSend + ";set pos;" + std::to_string(static_cast<int>(x)) + "," + std::to_string(static_cast<int>(y)) + "," + std::to_string(static_cast<int>(theta * 100)) + "\n");
+    this->sendMessage(toSend, PoseMessage{static_cast<float>(x), static_cast<float>(y), static_cast<float>(theta * 100)});
 }
 
 template<class X>
 void TCPServer::setPosition(std::array<X, 3> data, const std::string &toSend) {
-    this->broadcastMessage("strat;" + toSend + ";set pos;" + std::to_string(static_cast<int>(data[0])) + "," + std::to_string(static_cast<int>(data[1])) + "," + std::to_string(static_cast<int>(data[2] * 100)) + "\n");
+    this->setPosition(data[0], data[1], data[2], toSend);
 }
 
 void TCPServer::setPosition(const Position pos, const std::string &toSend) {
-    this->broadcastMessage("strat;" + toSend + ";set pos;" + std::to_string(static_cast<int>(pos.pos.x)) + "," + std::to_string(static_cast<int>(pos.pos.y)) + "," + std::to_string(static_cast<int>(pos.theta * 100)) + "\n");
+    this->sendMessage(toSend, poseMessage(pos));
+}
+
+template<class Message>
+void TCPServer::sendMessage(const std::string_view receiver, const Message& message, const int clientSocket) {
+    Messages::Buffer buffer;
+    std::string_view line = Messages::encode("strat", receiver, message, buffer);
+    if (clientSocket == -1) {
+        this->routeMessage(line);
+    } else {
+        this->sendToClient(line, clientSocket);
+    }
+}
+
+template<class Message>
+void TCPServer::sendMotion(const Message& message) {
+    this->startMotion();
+    // The same frame is queued now and kept to be sent again
+    FramePtr frame = Messages::toFrame("strat", "arduino", message);
+    std::atomic_store(&lastArduinoCommand, frame);
+    this->routeFrame(frame);
+}
+
+PoseMessage TCPServer::poseMessage(const Position& pos) {
+    return {pos.pos.x, pos.pos.y, pos.theta * 100};
 }
 
 void TCPServer::baisserBras() {
-    this->broadcastMessage("strat;servo_moteur;baisser bras;1\n");
+    this->routeMessage("strat;servo_moteur;baisser bras;1\n");
 }
 
 void TCPServer::transportBras() {
-    this->broadcastMessage("strat;servo_moteur;transport bras;1\n");
+    this->routeMessage("strat;servo_moteur;transport bras;1\n");
 }
 
 void TCPServer::leverBras() {
-    this->broadcastMessage("strat;servo_moteur;lever bras;1\n");
+    this->routeMessage("strat;servo_moteur;lever bras;1\n");
 }
 
 void TCPServer::openPince(int pince) {
-    this->broadcastMessage("strat;servo_moteur;ouvrir pince;" + std::to_string(pince) + "\n");
+    this->routeMessage("strat;servo_moteur;ouvrir pince;" + std::to_string(pince) + "\n");
 }
 
 void TCPServer::fullyOpenPince(int pince) {
-    this->broadcastMessage("strat;servo_moteur;ouvrir total pince;" + std::to_string(pince) + "\n");
+    this->routeMessage("strat;servo_moteur;ouvrir total pince;" + std::to_string(pince) + "\n");
 }
 
 void TCPServer::middlePince(int pince) {
-    this->broadcastMessage("strat;servo_moteur;middle pince;" + std::to_string(pince) + "\n");
+    this->routeMessage("strat;servo_moteur;middle pince;" + std::to_string(pince) + "\n");
 }
 
 void TCPServer::closePince(int pince) {
-    this->broadcastMessage("strat;servo_moteur;fermer pince;" + std::to_string(pince) + "\n");
+    this->routeMessage("strat;servo_moteur;fermer pince;" + std::to_string(pince) + "\n");
 }
 
 void TCPServer::checkPanneau(int servo_moteur) {
-    this->broadcastMessage("strat;servo_moteur;check panneau;" + std::to_string(servo_moteur) + "\n");
+    this->routeMessage("strat;servo_moteur;check panneau;" + std::to_string(servo_moteur) + "\n");
 }
 
 void TCPServer::uncheckPanneau(int servo_moteur) {
-    this->broadcastMessage("strat;servo_moteur;uncheck panneau;" + std::to_string(servo_moteur) + "\n");
+    this->routeMessage("strat;servo_moteur;uncheck panneau;" + std::to_string(servo_moteur) + "\n");
 }
 
 void TCPServer::askLidarPosition() {
-    this->broadcastMessage("start;lidar;get pos;1\n");
+    this->sendMessage("lidar", GetPosMessage{});
 }
 
 void TCPServer::sendPoint(int point) {
-    this->broadcastMessage("strat;ihm;add point;" + std::to_string(point) + "\n");
+    this->sendMessage("ihm", PointMessage{point});
+    this->score += point;
+    this->setState(STATE_SCORE, std::to_string(score));
 }
 
 void TCPServer::setTeam(Team team) {
     this->team = team;
-    this->broadcastMessage("strat;all;set team;" + std::to_string(team) + "\n");
+    this->setState(STATE_TEAM, std::to_string(team));
+    this->sendMessage("all", TeamMessage{team});
 }
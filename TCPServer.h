@@ -2,9 +2,14 @@
 
 #include <iostream>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <cstring>
+#include <cerrno>
 #include <thread>
 #include <utility>
 #include <vector>
@@ -12,23 +17,76 @@
 #include <atomic>
 #include <fstream>
 #include <optional>
+#include <unordered_map>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <memory_resource>
+#include <functional>
 
 #include "utils.h"
+#include "LineFramer.h"
+#include "OutboundQueue.h"
+#include "RequestTracker.h"
+#include "BinaryProtocol.h"
+#include "ShmTransport.h"
+#include "IoUring.h"
+#include "ClientRegistry.h"
+#include "Handoff.h"
+#include "StateStore.h"
+#include "Messages.h"
 
 #define MAX_SPEED 200
 #define MIN_SPEED 150
 
+#define POSE_STREAM_PERIOD_MS 20
+#define POSE_STREAM_THRESHOLD 5
+
+#define MOTION_TIMEOUT_MS 4000
+#define STATE_POLL_PERIOD_MS 50
+
+#define MAX_EPOLL_EVENTS 32
+#define MAX_REACTORS 16
+#define REACTOR_ARENA_SIZE (64 * 1024) // Scratch memory of one batch before the arena falls back to malloc
+
+#define HANDOFF_DRAIN_TIMEOUT_MS 500 // Longest wait for the io_uring sends in flight before a handoff
+
 struct ClientTCP
 {
     std::string name;
     int socket = -1;
     bool isReady = false;
+    bool seen = false; // Was ready before, a new ready resumes its session
 
     ClientTCP() = default;
 
     explicit ClientTCP(std::string name, int socket = -1) : name(std::move(name)), socket(socket) {}
 };
 
+// Optional protocol features a client announces in the arguments of ready, e.g. "1,ids"
+enum ClientFeature {
+    FEATURE_REQUEST_ID = 1 << 0, // Echo the correlation id of a request in its answer
+    FEATURE_BINARY = 1 << 1, // Exchange pose, speed, state and aruco as binary frames
+};
+
+enum IoBackend {
+    IO_BACKEND_EPOLL,
+    IO_BACKEND_URING, // Falls back to epoll when the kernel refuses the ring
+};
+
+// Type of an io_uring operation, stored in its user_data
+enum UringOperation {
+    URING_ACCEPT = 1,
+    URING_RECV,
+    URING_SEND,
+    URING_WAKEUP,
+    URING_SHARED_MEMORY,
+    URING_CANCEL,
+    URING_TIMEOUT,
+};
+
 enum Team {
     BLUE,
     YELLOW,
@@ -70,28 +128,118 @@ class ClientHandler {
 private:
     int clientSocket;
     TCPServer* server; // Reference to the TCPServer instance
+    LineFramer framer; // Keep the partial line between two recv
 
 public:
+    bool waitingForOutput = false; // EPOLLOUT is armed because the outbound queue is not empty
+    std::unique_ptr<ShmTransport> shm; // Set once the client switched to shared memory rings
+    uint32_t generation = 0; // Tell completions of this connection from the ones of an older socket with the same fd
+    bool sending = false; // A chain of io_uring sends is in flight
+
     explicit ClientHandler(int clientSocket, TCPServer* server);
 
-    void handle();
+    // Read everything available on the non-blocking socket, return false once the connection is gone
+    bool handle();
+
+    // Read everything the client wrote in its shared memory ring
+    bool handleSharedMemory();
+
+    // Frame bytes received by io_uring, return false once the connection is gone
+    bool handleReceived(std::string_view data);
 
-    void processMessage(const std::string& message);
+    bool processFramed();
+
+    // Partial line waiting for the rest of its bytes
+    [[nodiscard]] std::string_view pendingInput() const;
+
+    void processMessage(std::string_view message);
 
     void closeConnection();
 };
 
+// Frames handed to io_uring, kept alive until their chain of sends completes
+struct SendChain {
+    int clientSocket = -1;
+    uint32_t generation = 0;
+    std::vector<FramePtr> frames;
+    std::vector<std::string_view> bytes;
+    size_t completed = 0;
+    bool failed = false;
+};
+
+// One reactor thread with its own SO_REUSEPORT listener, epoll or io_uring instance and client set
+struct Reactor {
+    size_t index = 0;
+    int listenSocket = -1;
+    int epollFd = -1;
+    int wakeupFd = -1; // eventfd used to wake the reactor from other threads
+    std::thread thread;
+    std::unordered_map<int, ClientHandler> clientHandlers; // Owned by the reactor thread
+    std::unordered_map<int, int> sharedMemoryEvents; // Server eventfd of a shared memory client -> its socket
+    uint32_t nextGeneration = 0;
+
+    std::unordered_map<uint32_t, SendChain> sendChains;
+    uint32_t nextSendChain = 0;
+    size_t armedOperations = 0; // Multishot accept, recv and poll that can still complete
+    std::unique_ptr<IoUring> uring; // Set when the io_uring backend is used, destroyed before the frames it sends
+
+    // Mailbox filled by the other threads and reactors, sockets of this reactor whose queue got frames
+    std::vector<int> mailbox;
+    // Sockets replaced by a new connection of the same participant, with the generation of their handler
+    std::vector<std::pair<int, uint32_t>> retired;
+    std::mutex mailboxMutex;
+
+    // What the handlers derive from the messages of one batch is allocated here, released once the batch is handled
+    std::array<std::byte, REACTOR_ARENA_SIZE> arenaBuffer{};
+    std::pmr::monotonic_buffer_resource arena{arenaBuffer.data(), arenaBuffer.size()};
+};
+
+// A text message addressed to the server, split in its fields
+struct Command {
+    std::string_view message;
+    std::string_view sender;
+    std::string_view verb;
+    std::string_view args;
+    int clientSocket;
+};
+
+using CommandHandler = std::function<void(const Command&)>;
+
 class TCPServer {
 private:
-    int serverSocket;
-    std::vector<std::thread> clientThreads;
-    std::vector<int> clientSockets; // Store connected client sockets
-    int connectedClients = 0; // Track the number of connected clients
+    int unixSocket = -1; // Optional AF_UNIX listener for clients running on the same board, served by the first reactor
+    std::string unixSocketPath;
+    std::vector<std::unique_ptr<Reactor>> reactors;
+
+    // Connected clients, their outbound queue, routes and subscriptions, read without locking
+    ClientRegistry registry;
+    std::atomic<int> connectedClients = 0; // Track the number of connected clients
+
+    // The reactors share the robot state, messages are handled one at a time
+    std::mutex dispatchMutex;
     std::atomic<bool> _shouldStop = false; // Flag to indicate if the server should stop
-    std::vector<ClientTCP> clients; // Store connected clients
+
+    // Zero-downtime restart, the next server takes the sockets over through this unix socket
+    std::string handoffSocketPath;
+    int handoffSocket = -1;
+    int handoffPeer = -1; // Channel of the handoff in progress, shut down by stop()
+    std::mutex handoffMutex; // Guards handoffPeer
+    std::thread handoffThread;
+    std::atomic<bool> handoffRequested = false; // The reactors stop reading and leave their clients open
+    std::atomic<bool> handedOff = false; // The next server owns the sockets, nothing is closed or unlinked for it
+    std::vector<ClientTCP> clients; // Participants waited for before the match, indexed by name id
+    bool allClientsReady = false; // Every participant was ready once, later readies only resume sessions
 
     std::array<PinceState, 3> pinceState = {NONE, NONE, NONE};
-    int isRobotIdle = 0;
+
+    // Motion completion, go, rotate and transit start a motion that the arduino state reports complete
+    std::mutex motionMutex;
+    std::condition_variable motionCondition;
+    uint64_t motionCommandId = 0;
+    uint64_t completedMotionId = 0;
+    bool motionIssued = false; // A motion was started and nobody awaited it yet
+    int idleReports = 0;
+    bool sawRobotMoving = false;
 
     bool gameStarted = false;
 
@@ -114,6 +262,11 @@ private:
 
     std::vector<ArucoTag> arucoTags;
 
+    int score = 0;
+
+    // Versioned copy of the state above, what get value and watch values answer from
+    StateStore store;
+
     Team team;
 
     std::vector<StratPattern> stratPatterns = {
@@ -165,38 +318,166 @@ private:
     // This is the index of the current pattern
     int whereAmI = 0;
 
-    bool stopEmergency = false;
+    std::atomic<bool> stopEmergency = false;
     bool handleEmergencyFlag = false;
 
-    bool awaitForLidar = false;
+    RequestTracker requestTracker;
+
+    // Handlers of handleMessage indexed by verb id then sender id, filled by registerCommands
+    std::vector<CommandHandler> commandHandlers;
 
     std::thread gameThread;
 
-    int lidarSocket = -1;
-    int arduinoSocket = -1;
+    std::atomic<int> lidarSocket = -1;
+    std::atomic<int> arduinoSocket = -1; // Read by the pose polling thread while the arduino may reconnect
 
-    int lidarGetPosTimeout = 0;
+    std::atomic<bool> arduinoPoseStreaming = false; // The arduino pushes set pos without being asked
 
-    std::string lastArduinoCommand{};
+    FramePtr lastArduinoCommand; // Sent again if the motion times out, atomic_load and atomic_store it
+
+    // Polled while waiting for the arduino, serialized once
+    const FramePtr arduinoGetPos = Messages::toFrame("strat", "arduino", GetPosMessage{});
+    const FramePtr arduinoGetState = Messages::toFrame("strat", "arduino", GetStateMessage{});
 
 public:
-    explicit TCPServer(int port);
+    // listenFd is an already listening socket to serve instead of binding the port
+    // With handoffSocketPath, take the sockets and state of the server running there over if there is one
+    explicit TCPServer(int port, const std::string& unixSocketPath = "", IoBackend ioBackend = IO_BACKEND_EPOLL, int reactorCount = 1,
+                       int listenFd = -1, const std::string& handoffSocketPath = "");
 
     void start();
 
-    void acceptConnections();
+    void startReactors();
+
+    // Listen on the TCP port, every reactor binds its own socket with SO_REUSEPORT
+    static int listenTcp(int port);
+
+    // Check and prepare a listening socket inherited from the parent process
+    static int adoptListenSocket(int listenFd);
+
+    // Receive the sockets and the state of the running server, exit if it does not hand them over
+    void takeOver(int channel, HandoffState& state, std::vector<int>& fds);
+
+    void restoreHandoff(const HandoffState& state, const std::vector<int>& fds, size_t firstClientFd);
+
+    // Wait for the next server on the handoff socket
+    void runHandoffListener();
+
+    // Give the sockets and the state to the next server, resume serving if it does not confirm
+    bool handOff(int channel);
+
+    // Stop the reactors without closing their clients
+    void pauseReactors();
+
+    void captureHandoff(HandoffState& state, std::vector<int>& fds);
+
+    // Cancel every read of the reactor and wait for its sends in flight
+    void pauseUringReactor(Reactor& reactor);
+
+    void listenUnixSocket();
+
+    // Accept every pending connection of a listening socket
+    void acceptConnections(Reactor& reactor, int listenSocket);
+
+    ClientHandler& addClient(Reactor& reactor, int clientSocket);
+
+    // Reactor loop, own its listen socket and every client socket it accepted
+    void runReactor(Reactor& reactor);
+
+    // Same reactor over io_uring, one io_uring_enter submits the sends and waits for the next completions
+    void runUringReactor(Reactor& reactor);
+
+    void handleCompletion(Reactor& reactor, const io_uring_cqe& cqe);
+
+    void submitSends(Reactor& reactor, int clientSocket, ClientHandler& handler, OutboundQueue& queue);
+
+    void onSendCompleted(Reactor& reactor, uint32_t chainId, int result);
+
+    static void wakeupReactor(const Reactor& reactor);
+
+    void removeHandler(Reactor& reactor, std::unordered_map<int, ClientHandler>::iterator handler);
+
+    // Answer "shm;<capacity>" from a unix socket client by moving its traffic to shared memory rings
+    void setupSharedMemory(int clientSocket, std::string_view name, std::string_view args);
+
+    // Queue a frame for a client without blocking, the reactor writes it
+    void enqueue(int clientSocket, const FramePtr& frame);
+
+    // Post the socket to the mailbox of its reactor once its queue has frames
+    static void enqueue(const ClientEntry& client, const FramePtr& frame);
+
+    void flushDirtyClients(Reactor& reactor);
+
+    void flushClient(Reactor& reactor, int clientSocket);
 
     // Broadcast message to all connected clients
     void broadcastMessage(const char* message, int senderSocket = -1); // Modified method signature
-    void broadcastMessage(const std::string &message, int senderSocket = -1); // Modified method signature
+    void broadcastMessage(std::string_view message, int senderSocket = -1); // Modified method signature
+
+    // Fan out an already serialized frame, every queue shares it
+    void broadcastFrame(const FramePtr& frame, int senderSocket = -1);
+
+    // Send to the clients registered under the receiver field, broadcast for "all" or unknown receivers
+    void routeMessage(std::string_view message, int senderSocket = -1);
+
+    // Route a frame built beforehand, to its receiver or to everybody
+    void routeFrame(const FramePtr& frame, int senderSocket = -1);
+
+    // Copy a message to the clients subscribed to its sender/verb, except the sender and the clients it was routed to
+    void publishTopic(const RegistrySnapshot& snapshot, std::string_view message, FramePtr frame, int senderSocket, const std::vector<int>& delivered);
+
+    // Route the client under its name, return the interned id of the name or -1
+    // A participant has a single connection, the one it replaces is retired
+    int addRoute(std::string_view name, int clientSocket, int features = 0);
+
+    // Close a replaced connection from the reactor that owns it
+    static void retire(const ClientEntry& client);
+
+    static int parseFeatures(std::string_view readyArgs);
+
+    // Send verb;args to destination and return its answer, matched by correlation id when the client supports it
+    Reply request(std::string_view destination, std::string_view verb, std::string_view args, std::chrono::milliseconds timeout);
 
     void sendToClient(const char* message, int clientSocket); // New method to send message to a specific client
-    void sendToClient(const std::string &message, int clientSocket); // New method to send message to a specific client
+    void sendToClient(std::string_view message, int clientSocket); // New method to send message to a specific client
 
     void sendToClient(const char* message, const std::string& clientName); // New method to send message to a specific client
     void sendToClient(const std::string &message, const std::string& clientName); // New method to send message to a specific client
 
-    void handleMessage(const std::string& message, int clientSocket = -1);
+    // Entry point of the reactors, one message at a time whatever reactor received it
+    void dispatchMessage(std::string_view message, int clientSocket);
+
+    void handleMessage(std::string_view message, int clientSocket = -1);
+
+    // Memory for temporaries derived from an inbound message, never kept past the handler
+    // The arena of the reactor running the handler, the default resource on the other threads
+    static std::pmr::memory_resource* scratch();
+
+    // Answer get value or watch values with a stored value
+    void sendStoredValue(std::string_view name, StateKey key, const StateValue& stored, int clientSocket);
+
+    // Fill the dispatch table of handleMessage
+    void registerCommands();
+
+    // Handle the verb from the sender, "*" for the senders without a handler of their own
+    // The verb must be in COMMAND_VERBS and the sender in PARTICIPANTS
+    void onCommand(std::string_view sender, std::string_view verb, CommandHandler handler);
+
+    // nullptr if the server ignores the verb from this sender
+    [[nodiscard]] const CommandHandler* findCommand(std::string_view sender, std::string_view verb) const;
+
+    void handleStopProximity(std::string_view args);
+
+    void handleSpawn(std::string_view args);
+
+    void startMatch(std::string_view message, int clientSocket);
+
+    void handleArucoResponse(std::string_view message, std::string_view args, int clientSocket);
+
+    void handleBinaryMessage(std::string_view frame, int clientSocket = -1);
+
+    // theta in radian
+    void onArduinoPose(float x, float y, float theta);
 
     void clientDisconnected(int clientSocket); // New method to handle client disconnection
 
@@ -214,10 +495,76 @@ public:
 
     void askArduinoPos();
 
+    // A participant of the match sent ready, return true if it resumes an earlier session
+    bool participantReady(int nameId, int clientSocket);
+
+    // Bring a reconnected client up to date in one batch : pose, speed, team, pinces and game phase
+    void sendSnapshot(std::string_view name, int clientSocket);
+
+    void addPoseSubscriber(int clientSocket);
+
+    void removePoseSubscriber(int clientSocket);
+
+    // Add or remove StateKey bits of the keys a client watches, "unwatch values;<key>,..." removes them
+    void watchKeys(int clientSocket, uint32_t keys, bool watch);
+
+    // "subscribe;<pattern>,..." with sender/verb patterns, see TopicMatcher
+    void subscribeTopics(std::string_view patterns, int clientSocket);
+
+    // "unsubscribe;<pattern>,..." or "unsubscribe;all"
+    void unsubscribeTopics(std::string_view patterns, int clientSocket);
+
+    // Push the robot pose to every subscriber
+    void publishPose();
+
+    // Store a new value of a state key and push it to the clients watching it
+    void setState(StateKey key, std::string value);
+
+    // Answer "get value;<key>"
+    void sendValue(std::string_view name, std::string_view key, int clientSocket);
+
+    // "watch values;<since>,<key>,..." sends the keys changed since the version then every change, no key means all of them
+    void watchValues(std::string_view name, std::string_view args, int clientSocket);
+
+
+    // Key bits of a list of key names, "all" for every key
+    static uint32_t parseKeys(std::string_view keys);
+
+    static std::string formatPose(const Position& pos);
+
+    static PoseMessage poseMessage(const Position& pos);
+
+    // Encode a message of strat on the stack, routed to the receiver or sent to clientSocket if it is not -1
+    template<class Message>
+    void sendMessage(std::string_view receiver, const Message& message, int clientSocket = -1);
+
+    // Start a motion of the arduino, remembered in lastArduinoCommand
+    template<class Message>
+    void sendMotion(const Message& message);
+
+    [[nodiscard]] std::string_view gamePhase() const;
+
+    void publishPhase();
+
+    void setPinceState(int pince, PinceState state);
+
+    void publishPinces();
+
+    void clearArucoTags();
+
+    void publishArucoTags();
+
     [[nodiscard]] bool shouldStop() const;
 
+    // Block until the arduino reports the last motion done, -1 when the match is over, 1 on timeout
     int awaitRobotIdle();
 
+    void startMotion();
+
+    void startMotionLocked();
+
+    void onArduinoState(bool idle);
+
     void handleArucoTag(const ArucoTag &tag);
 
     std::optional<ArucoTag> getBiggestArucoTag(float borneMinX, float borneMaxX, float borneMinY, float borneMaxY);
@@ -0,0 +1,105 @@
+#include "TopicMatcher.h"
+
+#include <algorithm>
+
+bool TopicMatcher::validPattern(const std::string_view pattern) {
+    size_t separator = pattern.find(TOPIC_SEPARATOR);
+    if (separator == std::string_view::npos) {
+        return false;
+    }
+
+    // A wildcard can only be the last character of each side
+    for (std::string_view side : {pattern.substr(0, separator), pattern.substr(separator + 1)}) {
+        size_t wildcard = side.find(TOPIC_WILDCARD);
+        if (side.empty() || side.find(TOPIC_SEPARATOR) != std::string_view::npos ||
+            (wildcard != std::string_view::npos && wildcard != side.size() - 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TopicMatcher::add(const std::string_view pattern, const int subscriber) {
+    size_t separator = pattern.find(TOPIC_SEPARATOR);
+    std::string_view sender = pattern.substr(0, separator);
+    std::string_view verb = pattern.substr(separator + 1);
+
+    bool anySender = sender.back() == TOPIC_WILDCARD;
+    if (anySender) {
+        sender.remove_suffix(1);
+    }
+    int senderNode = this->insert(0, sender);
+
+    int verbRoot = anySender ? nodes[senderNode].anyVerbs : nodes[senderNode].verbs;
+    if (verbRoot == -1) {
+        verbRoot = static_cast<int>(nodes.size());
+        nodes.emplace_back();
+        (anySender ? nodes[senderNode].anyVerbs : nodes[senderNode].verbs) = verbRoot;
+    }
+
+    bool anyVerb = verb.back() == TOPIC_WILDCARD;
+    if (anyVerb) {
+        verb.remove_suffix(1);
+    }
+    int verbNode = this->insert(verbRoot, verb);
+    (anyVerb ? nodes[verbNode].prefix : nodes[verbNode].exact).push_back(subscriber);
+}
+
+void TopicMatcher::match(const std::string_view sender, const std::string_view verb, std::pmr::vector<int>& subscribers) const {
+    size_t first = subscribers.size();
+
+    int node = 0;
+    for (size_t i = 0; node != -1; i++) {
+        if (nodes[node].anyVerbs != -1) {
+            this->matchVerb(nodes[node].anyVerbs, verb, subscribers);
+        }
+        if (i == sender.size()) {
+            if (nodes[node].verbs != -1) {
+                this->matchVerb(nodes[node].verbs, verb, subscribers);
+            }
+            break;
+        }
+        node = this->child(node, sender[i]);
+    }
+
+    std::sort(subscribers.begin() + first, subscribers.end());
+    subscribers.erase(std::unique(subscribers.begin() + first, subscribers.end()), subscribers.end());
+}
+
+int TopicMatcher::insert(int node, const std::string_view literal) {
+    for (char c : literal) {
+        auto& children = nodes[node].children;
+        auto it = std::lower_bound(children.begin(), children.end(), std::make_pair(c, 0),
+                                   [](const auto& a, const auto& b) { return a.first < b.first; });
+        if (it != children.end() && it->first == c) {
+            node = it->second;
+            continue;
+        }
+
+        int next = static_cast<int>(nodes.size());
+        children.insert(it, {c, next});
+        // Invalidates the children reference
+        nodes.emplace_back();
+        node = next;
+    }
+    return node;
+}
+
+int TopicMatcher::child(const int node, const char c) const {
+    const auto& children = nodes[node].children;
+    auto it = std::lower_bound(children.begin(), children.end(), std::make_pair(c, 0),
+                               [](const auto& a, const auto& b) { return a.first < b.first; });
+    return it != children.end() && it->first == c ? it->second : -1;
+}
+
+void TopicMatcher::matchVerb(int node, const std::string_view verb, std::pmr::vector<int>& subscribers) const {
+    for (size_t i = 0; node != -1; i++) {
+        const Node& current = nodes[node];
+        subscribers.insert(subscribers.end(), current.prefix.begin(), current.prefix.end());
+        if (i == verb.size()) {
+            subscribers.insert(subscribers.end(), current.exact.begin(), current.exact.end());
+            return;
+        }
+        node = this->child(node, verb[i]);
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#define TOPIC_SEPARATOR '/'
+#define TOPIC_WILDCARD '*'
+
+/*
+ * Subscriptions to "sender/verb" patterns compiled into a trie.
+ *
+ * A '*' may only end a side of the pattern and matches any rest of it, "arduino/set *" takes every set verb
+ * of the arduino and a side that is a lone '*' takes any sender or any verb.
+ * The senders form one trie, each sender node leads to a trie of the verbs, so matching a message walks
+ * its sender and verb once whatever the number of subscriptions.
+ */
+class TopicMatcher {
+public:
+    [[nodiscard]] static bool validPattern(std::string_view pattern);
+
+    // The pattern must be valid
+    void add(std::string_view pattern, int subscriber);
+
+    // Append the subscribers of the patterns matching the topic, a subscriber once even if several patterns match
+    void match(std::string_view sender, std::string_view verb, std::pmr::vector<int>& subscribers) const;
+
+private:
+    struct Node {
+        std::vector<std::pair<char, int>> children; // Sorted by character
+        int verbs = -1; // Sender node : verb trie of the senders ending here
+        int anyVerbs = -1; // Sender node : verb trie of the senders starting with this prefix
+        std::vector<int> exact; // Verb node : subscribers of the verbs ending here
+        std::vector<int> prefix; // Verb node : subscribers of the verbs starting with this prefix
+    };
+
+    // Follow or create the path of the literal part of a side
+    int insert(int node, std::string_view literal);
+
+    [[nodiscard]] int child(int node, char c) const;
+
+    void matchVerb(int root, std::string_view verb, std::pmr::vector<int>& subscribers) const;
+
+    std::vector<Node> nodes = {Node()}; // nodes[0] is the root of the sender trie
+};
@@ -11,12 +11,34 @@ void signalHandler( int signum ) {
 int main(int argc, char* argv[]) {
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+    // A client closing its socket must not kill the server on the next write
+    signal(SIGPIPE, SIG_IGN);
 
     CLParser clParser(argc, argv);
 
     int port = clParser.getOption<int>("port", 8080);
 
-    TCPServer server(port);
+    // Empty to only listen on TCP
+    auto unixSocketPath = clParser.getOption<std::string>("unix-socket", "");
+
+    // uring to drive the sockets with io_uring instead of epoll
+    auto ioBackendName = clParser.getOption<std::string>("io-backend", "epoll");
+    if (ioBackendName != "epoll" && ioBackendName != "uring") {
+        std::cerr << "Unknown io backend : " << ioBackendName << std::endl;
+        return 1;
+    }
+
+    // Reactor threads, each with its own listen socket on the port
+    int reactorCount = clParser.getOption<int>("reactors", 1);
+
+    // Listening socket inherited from the parent process, e.g. socket activation
+    int listenFd = clParser.getOption<int>("listen-fd", -1);
+
+    // Restart without dropping the clients, a new server started with the same path takes them over
+    auto handoffSocketPath = clParser.getOption<std::string>("handoff-socket", "");
+
+    TCPServer server(port, unixSocketPath, ioBackendName == "uring" ? IO_BACKEND_URING : IO_BACKEND_EPOLL, reactorCount,
+                     listenFd, handoffSocketPath);
 
     try {
         server.start();
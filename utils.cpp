@@ -1,11 +1,11 @@
 #include "utils.h"
 
-bool TCPUtils::startWith(const std::string& str, const std::string& start)
+bool TCPUtils::startWith(const std::string_view str, const std::string_view start)
 {
     return str.rfind(start, 0) == 0;
 }
 
-bool TCPUtils::endWith(const std::string& str, const std::string& end)
+bool TCPUtils::endWith(const std::string_view str, const std::string_view end)
 {
     if (str.length() >= end.length())
     {
@@ -14,7 +14,7 @@ bool TCPUtils::endWith(const std::string& str, const std::string& end)
     return false;
 }
 
-bool TCPUtils::contains(const std::string& str, const std::string& sub)
+bool TCPUtils::contains(const std::string_view str, const std::string_view sub)
 {
     return str.find(sub) != std::string::npos;
 }
@@ -34,6 +34,18 @@ std::vector<std::string> TCPUtils::split(const std::string& str, const std::stri
     return tokens;
 }
 
+bool TCPUtils::nextToken(std::string_view& str, const char delimiter, std::string_view& token)
+{
+    while (!str.empty()) {
+        size_t pos = str.find(delimiter);
+        if (pos == std::string_view::npos) pos = str.size();
+        token = str.substr(0, pos);
+        str.remove_prefix(pos == str.size() ? pos : pos + 1);
+        if (!token.empty()) return true;
+    }
+    return false;
+}
+
 
 ArucoTag::ArucoTag(int id, std::string name, std::array<float, 2> pos, std::array<float, 3> rot) : _id(id), _name(std::move(name)), _pos(pos), _rot(rot) {}
 
@@ -4,8 +4,10 @@
 #include <utility>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <ostream>
 #include <cmath>
+#include <charconv>
 
 #define PI 3.14159265358979323846
 
@@ -17,13 +19,72 @@ enum PinceState {
 };
 
 namespace TCPUtils {
-    bool startWith(const std::string& str, const std::string& start);
+    bool startWith(std::string_view str, std::string_view start);
 
-    bool endWith(const std::string& str, const std::string& end);
+    bool endWith(std::string_view str, std::string_view end);
 
-    bool contains(const std::string& str, const std::string& sub);
+    bool contains(std::string_view str, std::string_view sub);
 
     std::vector<std::string> split(const std::string& str, const std::string& delimiter);
+
+    // Pop the next non-empty field off the front of str, return false once str is exhausted
+    bool nextToken(std::string_view& str, char delimiter, std::string_view& token);
+
+    // Split into views of str without allocating, empty fields are skipped like split()
+    // Return the total number of fields, only the first N are stored
+    template<size_t N>
+    size_t splitView(std::string_view str, char delimiter, std::array<std::string_view, N>& tokens);
+
+    // Parse a whole field as a number, return false instead of throwing on bad input
+    template<class T>
+    bool parseNumber(std::string_view str, T& value);
+
+    // Parse exactly N comma separated numbers
+    template<class T, size_t N>
+    bool parseArgs(std::string_view args, std::array<T, N>& values);
+}
+
+template<size_t N>
+size_t TCPUtils::splitView(std::string_view str, const char delimiter, std::array<std::string_view, N>& tokens) {
+    size_t count = 0;
+    std::string_view token;
+    while (nextToken(str, delimiter, token)) {
+        if (count < N) {
+            tokens[count] = token;
+        }
+        count++;
+    }
+    return count;
+}
+
+template<class T>
+bool TCPUtils::parseNumber(std::string_view str, T& value) {
+    while (!str.empty() && (str.front() == ' ' || str.front() == '+')) str.remove_prefix(1);
+    while (!str.empty() && (str.back() == ' ' || str.back() == '\r' || str.back() == '\n')) str.remove_suffix(1);
+
+    T parsed{};
+    const char* end = str.data() + str.size();
+    auto [ptr, ec] = std::from_chars(str.data(), end, parsed);
+    if (ec != std::errc() || ptr != end || str.empty()) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+template<class T, size_t N>
+bool TCPUtils::parseArgs(const std::string_view args, std::array<T, N>& values) {
+    std::array<std::string_view, N> fields;
+    if (splitView(args, ',', fields) != N) {
+        return false;
+    }
+
+    for (size_t i = 0; i < N; i++) {
+        if (!parseNumber(fields[i], values[i])) {
+            return false;
+        }
+    }
+    return true;
 }
 
 class ArucoTag {